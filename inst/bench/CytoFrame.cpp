@@ -0,0 +1,44 @@
+/*
+ * timings of the cytoframe IO, which are kept out of the unit tests
+ * since they work on the large data and only print the numbers
+ */
+#include <cytolib/MemCytoFrame.hpp>
+#include <cytolib/H5CytoFrame.hpp>
+#include <boost/test/unit_test.hpp>
+#include <cytolib/global.hpp>
+using namespace cytolib;
+
+BOOST_AUTO_TEST_SUITE(CytoFrame_bench)
+BOOST_AUTO_TEST_CASE(h5_direct_chunk_read)
+{
+	FCS_READ_PARAM config;
+	MemCytoFrame fr("../flowWorkspace/wsTestSuite/curlyQuad/example1/A1001.001.fcs", config);
+	fr.read_fcs();
+	//10M events of 4 channels with the default (unfiltered, one chunk per channel) layout
+	auto fr0 = fr.copy(uvec({0, 1, 2, 3}), false);
+	unsigned n = 1e7 / fr0->n_rows() + 1;
+	fr0->set_data(arma::repmat(fr0->get_data(), n, 1));
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr0->write_h5(h5file);
+	fr0.reset();
+
+	{
+		H5CytoFrame fr1(h5file, true);
+		H5_CACHE_PARAM param = fr1.get_h5_cache_param();
+		param.direct_chunk_read = true;
+		fr1.set_h5_cache_param(param);
+		double start = gettime();
+		EVENT_DATA_VEC dat1 = fr1.get_data();
+		cout << "get_data() of " << dat1.n_rows << " events by direct chunk reads: " << gettime() - start << endl;
+
+		param.direct_chunk_read = false;
+		fr1.set_h5_cache_param(param);
+		start = gettime();
+		EVENT_DATA_VEC dat2 = fr1.get_data();
+		cout << "get_data() of " << dat2.n_rows << " events by hyperslab selection: " << gettime() - start << endl;
+		BOOST_CHECK(arma::approx_equal(dat1, dat2, "absdiff", 0));
+	}
+	H5FileCache::instance().evict(h5file);
+	fs::remove(h5file);
+}
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,7 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE "C++ Benchmarks for cytolib"
+#include <boost/test/unit_test.hpp>
+
+#include <cytolib/global.hpp>
+
+using namespace cytolib;
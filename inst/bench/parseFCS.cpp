@@ -0,0 +1,27 @@
+/*
+ * timings of parsing FCS, which are kept out of the unit tests
+ * since they take a while and only print the numbers
+ */
+#include <cytolib/MemCytoFrame.hpp>
+#include <boost/test/unit_test.hpp>
+#include <cytolib/global.hpp>
+using namespace cytolib;
+
+BOOST_AUTO_TEST_SUITE(parseFCS_bench)
+BOOST_AUTO_TEST_CASE(thread_scaling)
+{
+	string filename="../flowCore/misc/double_precision/wishbone_thymus_panel1_rep1.fcs";
+	FCS_READ_PARAM config;
+	MemCytoFrame cf(filename.c_str(), config);
+	cf.read_fcs();
+	for(int n : {1, 2, 4, 8, 16, 32})
+	{
+		config.data.num_threads = n;
+		double start = gettime();
+		MemCytoFrame cytofrm(filename.c_str(), config);
+		cytofrm.read_fcs();
+		cout << "num_threads=" << n << ": " << gettime() - start << endl;
+		BOOST_CHECK(arma::approx_equal(cf.get_data(), cytofrm.get_data(), "absdiff", 0));
+	}
+}
+BOOST_AUTO_TEST_SUITE_END()
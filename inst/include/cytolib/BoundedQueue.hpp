@@ -0,0 +1,80 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * BoundedQueue.hpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_BOUNDEDQUEUE_HPP_
+#define INST_INCLUDE_CYTOLIB_BOUNDEDQUEUE_HPP_
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+using namespace std;
+
+namespace cytolib
+{
+/**
+ * A thread-safe FIFO with fixed capacity that connects the stages of a producer/consumer pipeline
+ *
+ * push blocks when the queue is full so that the producers can't run ahead of the consumer (backpressure)
+ * and pop blocks when it is empty.
+ * Once closed, push fails immediately and pop keeps returning the remaining items until the queue is drained.
+ */
+template<class T>
+class BoundedQueue{
+	queue<T> items_;
+	size_t capacity_;
+	bool closed_;
+	mutex mutex_;
+	condition_variable not_full_;
+	condition_variable not_empty_;
+public:
+	explicit BoundedQueue(size_t capacity):capacity_(max<size_t>(1, capacity)), closed_(false){}
+	BoundedQueue(const BoundedQueue &) = delete;
+	BoundedQueue & operator=(const BoundedQueue &) = delete;
+
+	/**
+	 * @return false if the queue has been closed and the item is dropped
+	 */
+	bool push(T item)
+	{
+		unique_lock<mutex> lock(mutex_);
+		not_full_.wait(lock, [this]{return closed_ || items_.size() < capacity_;});
+		if(closed_)
+			return false;
+		items_.push(std::move(item));
+		not_empty_.notify_one();
+		return true;
+	}
+	/**
+	 * @return false if the queue has been closed and there is nothing left to pop
+	 */
+	bool pop(T & item)
+	{
+		unique_lock<mutex> lock(mutex_);
+		not_empty_.wait(lock, [this]{return closed_ || !items_.empty();});
+		if(items_.empty())
+			return false;
+		item = std::move(items_.front());
+		items_.pop();
+		not_full_.notify_one();
+		return true;
+	}
+	/**
+	 * wake up all the blocked producers and consumers
+	 */
+	void close()
+	{
+		lock_guard<mutex> lock(mutex_);
+		closed_ = true;
+		not_full_.notify_all();
+		not_empty_.notify_all();
+	}
+};
+
+};
+
+#endif /* INST_INCLUDE_CYTOLIB_BOUNDEDQUEUE_HPP_ */
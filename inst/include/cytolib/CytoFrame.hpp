@@ -15,6 +15,7 @@
 using namespace arma;
 #include <boost/lexical_cast.hpp>
 #include <cytolib/global.hpp>
+#include <cytolib/RowNames.hpp>
 #include <unordered_map>
 
 #include <H5Cpp.h>
@@ -32,7 +33,26 @@ enum DataTypeLocation {MEM, H5};
 typedef unordered_map<string, string> PDATA;
 
 const H5std_string  DATASET_NAME( "data");
-const H5std_string  DATASET_ROWNAME( "rownames");
+/**
+ * the ids of the registered third-party filters
+ */
+const H5Z_filter_t H5_FILTER_LZ4 = 32004;
+const H5Z_filter_t H5_FILTER_ZSTD = 32015;
+
+/**
+ * build the creation properties (chunk and filters) of the events dataset
+ * @param nCol the number of channels
+ * @param nEvents the number of events, which caps the chunk size along the event axis
+ */
+DSetCreatPropList h5_events_plist(const H5_WRITE_PARAM & param, hsize_t nCol, hsize_t nEvents);
+/**
+ * build the access properties used to create the h5 file, i.e. the file format version
+ */
+FileAccPropList h5_create_plist(const H5_WRITE_PARAM & param);
+/**
+ * recover the H5_WRITE_PARAM from an existing events dataset so that it can be reused for the derived files
+ */
+H5_WRITE_PARAM h5_events_param(const DataSet & dataset);
 
 /*
  * simple vector version of keyword type
@@ -46,6 +66,57 @@ struct KEY_WORDS_SIMPLE{
 
 class CytoFrame;
 typedef shared_ptr<CytoFrame> CytoFramePtr;
+
+/**
+ * h5 container stores the cytoframes of multiple samples as the groups (/samples/<sample_uid>) of a single h5 file.
+ * Each of its cytoframes is addressed by the uri <container file>#<sample_uid> (see H5ContainerCytoFrame)
+ */
+const string H5_CONTAINER_EXT = ".h5c";
+const string H5_CONTAINER_FILENAME = "cytoframes" + H5_CONTAINER_EXT;
+const string H5_CONTAINER_GROUP = "/samples";
+string h5_container_uri(const string & container, const string & sample_uid);
+/**
+ * split the h5 container uri
+ * @return false when the uri doesn't point to a sample of h5 container (e.g. the regular h5 file)
+ */
+bool parse_h5_container_uri(const string & uri, string & container, string & sample_uid);
+inline bool is_h5_container_uri(const string & uri){
+	string container, sample_uid;
+	return parse_h5_container_uri(uri, container, sample_uid);
+}
+/**
+ * list the samples of the h5 container
+ */
+vector<string> list_h5_container(const string & container);
+/**
+ * whether the sample is in the h5 container, which is checked without listing all the samples
+ */
+bool has_h5_container_sample(const string & container, const string & sample_uid);
+/**
+ * save the cytoframe as a sample of the h5 container, the container is created if not exists.
+ * The existing sample with the same name is replaced.
+ * @param uri the h5 container uri of the sample
+ * @return the newly written cytoframe opened for write
+ */
+CytoFramePtr write_h5_container(const CytoFrame & fr, const string & uri, const H5_WRITE_PARAM & param = H5_WRITE_PARAM());
+/**
+ * delete the sample from the h5 container. The disk space is not reclaimed until the container is repacked (i.e. h5repack)
+ */
+void remove_h5_container_sample(const string & uri);
+/**
+ * memory mapped cytoframe stores the raw events in <name>.mmap and the meta data in the h5 sidecar <name>.mmap.meta
+ * (see MappedCytoFrame)
+ */
+const string MMAP_EXT = ".mmap";
+const string MMAP_META_EXT = ".meta";
+inline string mmap_meta_path(const string & filename){
+	return filename + MMAP_META_EXT;
+}
+/**
+ * save the cytoframe as memory mapped cytoframe
+ * @param filename the path of the events file, the sidecar is written next to it
+ */
+void write_mmap(const CytoFrame & fr, const string & filename);
 struct KeyHash {
  std::size_t operator()(const string& k) const
  {
@@ -71,6 +142,11 @@ protected:
 	PARAM_MAP marker_vs_idx;//hash map for query by marker
 
 	CytoFrame (){};
+	/**
+	 * called before the meta data (params, keywords and pheno data) are accessed,
+	 * so that the backend can defer loading them from disk until they are actually needed (see H5CytoFrame)
+	 */
+	virtual void ensure_meta_loaded() const{};
 	virtual bool is_hashed() const
 	{
 		return channel_vs_idx.size()==n_cols();
@@ -96,6 +172,7 @@ public:
 
 	compensation get_compensation(const string & key = "$SPILLOVER")
 		{
+			ensure_meta_loaded();
 			compensation comp;
 
 			if(keys_.find(key)!=keys_.end())
@@ -143,10 +220,12 @@ public:
 	 */
 	const vector<cytoParam> & get_params() const
 	{
+		ensure_meta_loaded();
 		return params;
 	}
 	virtual void set_params(const vector<cytoParam> & _params)
 	{
+		ensure_meta_loaded();
 		params = _params;
 		build_hash();//update idx table
 
@@ -156,12 +235,14 @@ public:
 	FloatType h5_datatype_data(DataTypeLocation storage_type) const;
 	CompType get_h5_datatype_params(DataTypeLocation storage_type) const;
 	CompType get_h5_datatype_keys() const;
-	virtual void write_h5_params(H5File file) const;
+	virtual void write_h5_params(const H5Location & loc) const;
 	void write_to_disk(const string & filename, FileFormat format = FileFormat::H5
 				, const CytoCtx ctx = CytoCtx()) const
 		{
-
-				write_h5(filename);
+				if(format == FileFormat::MMAP)
+					write_mmap(*this, filename);
+				else
+					write_h5(filename, ctx.get_h5_write_param());
 
 		}
 
@@ -185,35 +266,19 @@ public:
 		}
 		return keyVec;
 	}
-	virtual void write_h5_keys(H5File file) const;
-	virtual void write_h5_pheno_data(H5File file) const;
-	virtual void write_h5_rownames(H5File file, vector<string> rn) const
+	virtual void write_h5_keys(const H5Location & loc) const;
+	virtual void write_h5_pheno_data(const H5Location & loc) const;
+	/**
+	 * replace the rownames under the h5 location, nothing is written for the empty rownames
+	 * @param legacy see H5_WRITE_PARAM::legacy_rownames
+	 */
+	virtual void write_h5_rownames(const H5Location & loc, const RowNames & rn, bool legacy = true) const
 	{
-		StrType str_type(H5::PredType::C_S1, H5T_VARIABLE);	//define variable-length string data type		hsize_t nSize = pheno_data_.size();
-		auto nSize = rn.size();
-		if(nSize > 0)
+		if(rn.size() > 0)
 		{
-
-			if(nSize!=n_rows())
+			if(rn.size()!=n_rows())
 				throw runtime_error("rowname size is not consistent with data size!");
-
-			DataSet ds;
-			auto dsname = DATASET_ROWNAME;
-			if(file.exists(dsname))
-				ds = file.openDataSet(dsname);
-			else
-			{
-				hsize_t     str_dimsf[1] {nSize};
-				H5::DataSpace   dataspace(1, str_dimsf);
-				ds = file.createDataSet(dsname, str_type, dataspace);
-			}
-			 // HDF5 only understands vector of char* :-(
-			std::vector<const char*> rn_c_str;
-			for (unsigned ii = 0; ii < rn.size(); ++ii)
-				rn_c_str.push_back(rn[ii].c_str());
-			ds.write(rn_c_str.data(), str_type );
-			ds.flush(H5F_SCOPE_LOCAL);
-
+			rn.write_h5(loc, legacy);
 		}
 	}
 
@@ -221,8 +286,13 @@ public:
 	 * save the CytoFrame as HDF5 format
 	 *
 	 * @param filename the path of the output H5 file
+	 * @param param the chunk layout and compression of the events
 	 */
-	virtual void write_h5(const string & filename) const;
+	virtual void write_h5(const string & filename, const H5_WRITE_PARAM & param = H5_WRITE_PARAM()) const;
+	/**
+	 * save the CytoFrame to an existing h5 location (the file root or a group)
+	 */
+	void write_h5_group(const H5Location & loc, const H5_WRITE_PARAM & param = H5_WRITE_PARAM()) const;
 	/**
 	 * get the data of entire event matrix
 	 * @return
@@ -231,6 +301,15 @@ public:
 	virtual vector<string> get_rownames() const=0;
 	virtual void set_rownames(const vector<string> & data_in)=0;
 	virtual void del_rownames()=0;
+	/**
+	 * the rownames in the compact form, which avoids creating a string per event (see RowNames)
+	 */
+	virtual RowNames get_compact_rownames() const{
+		return RowNames(get_rownames());
+	}
+	virtual void set_compact_rownames(const RowNames & data_in){
+		set_rownames(data_in.to_vector());
+	}
 	virtual EVENT_DATA_VEC get_data() const=0;
 	virtual EVENT_DATA_VEC get_data(uvec idx, bool is_col) const=0;
 	virtual EVENT_DATA_VEC get_data(uvec row_idx, uvec col_idx) const=0;
@@ -241,15 +320,29 @@ public:
 
 	virtual void set_data(const EVENT_DATA_VEC &)=0;
 	virtual void set_data(EVENT_DATA_VEC &&)=0;
+	/**
+	 * overwrite the given columns only, the other columns are left untouched
+	 *
+	 * The default implementation rewrites the entire matrix, the backends override it to write the touched columns only.
+	 * @param data_in the new data of the columns, in the order of col_idx
+	 * @param col_idx the unique column indices
+	 */
+	virtual void set_data(const EVENT_DATA_VEC & data_in, uvec col_idx);
+	/**
+	 * validate the input of the column-subset set_data
+	 */
+	void check_set_data_cols(const EVENT_DATA_VEC & data_in, const uvec & col_idx) const;
 	/**
 	 * extract all the keyword pairs
 	 *
 	 * @return a vector of pairs of strings
 	 */
 	 virtual const KEY_WORDS & get_keywords() const{
+		ensure_meta_loaded();
 		return keys_;
 	}
 	 virtual void set_keywords(const KEY_WORDS & keys){
+			ensure_meta_loaded();
 			keys_ = keys;
 		}
 	/**
@@ -267,6 +360,7 @@ public:
 	 */
 	virtual void set_keyword(const string & key, const string & value)
 	{
+		ensure_meta_loaded();
 		keys_[key] = value;
 	}
 
@@ -277,21 +371,19 @@ public:
 	 */
 	virtual void rename_keyword(const string & old_key, const string & new_key)
 	{
-		KW_PAIR::iterator it = keys_.find(old_key);
-        if(it!=keys_.end())
-        	it->first = new_key;
-        else
-        	throw(domain_error("keyword not found: " + old_key));
+		ensure_meta_loaded();
+		keys_.rename(old_key, new_key);
 	}
 
 	/**
 	 *	Remove a single key-value pair.
-	 *	KW_PAIR is vector based, so this is not particularly efficient
-	 *	as later elements will need to be relocated, but it is faster
+	 *	KEY_WORDS is vector based, so this is not particularly efficient
+	 *	as later elements will need to be relocated and re-indexed, but it is faster
 	 *	than completely reconstructing the KW_PAIR object.
 	 *	@param key keyword to be removed
 	 */
 	virtual void remove_keyword(const string & key){
+		ensure_meta_loaded();
 		keys_.erase(key);
 	}
 
@@ -302,6 +394,7 @@ public:
 	 */
 	virtual unsigned n_cols() const
 	{
+		ensure_meta_loaded();
 		return params.size();
 	}
 
@@ -500,16 +593,22 @@ public:
 	virtual void flush_meta(){};
 	virtual void load_meta(){};
 
-	const PDATA & get_pheno_data() const {return pheno_data_;}
+	const PDATA & get_pheno_data() const {
+		ensure_meta_loaded();
+		return pheno_data_;
+	}
 	string get_pheno_data(const string & name) const ;
 	virtual void set_pheno_data(const string & name, const string & value){
+		ensure_meta_loaded();
 		pheno_data_[name] = value;
 	}
 	virtual void set_pheno_data(const PDATA & _pd)
 	{
+		ensure_meta_loaded();
 		pheno_data_ = _pd;
 	}
 	virtual void del_pheno_data(const string & name){
+		ensure_meta_loaded();
 		pheno_data_.erase(name);}
 };
 };
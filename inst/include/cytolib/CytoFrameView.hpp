@@ -56,19 +56,20 @@ public:
 		return get_cytoframe_ptr()->get_backend_type();
 	};
 	vector<string> get_rownames() const{
-			vector<string> orig = get_cytoframe_ptr()->get_rownames();
+			return get_compact_rownames().to_vector();
+		}
+	/**
+	 * the rownames of the view, which share the storage of the ones of the frame
+	 */
+	RowNames get_compact_rownames() const{
+			RowNames orig = get_cytoframe_ptr()->get_compact_rownames();
 			unsigned n = row_idx_.size();
 			if(!is_row_indexed_)
 				return orig;
-			else if(n == 0||orig.size()==0)
-				return vector<string>();
+			else if(n == 0||orig.empty())
+				return RowNames();
 			else
-			{
-				vector<string> res(n);
-				for(unsigned i = 0; i < n; i++)
-					res[i] = orig[row_idx_[i]];
-				return res;
-			}
+				return orig.subset(row_idx_);
 		}
 
 	void del_rownames(){
@@ -129,7 +130,10 @@ public:
 				if(h5_opt == CytoFileOption::move&&oldh5!="")
 				{
 					if(!fs::equivalent(fs::path(oldh5), fs::path(cf_filename)))
+					{
+						H5FileCache::instance().evict(oldh5);
 						fs::remove_all(oldh5);
+					}
 
 				}
 			}
@@ -338,6 +342,11 @@ public:
 		return dynamic_pointer_cast<MemCytoFrame>(res);
 	}
 	void set_data(const EVENT_DATA_VEC & data_in);
+	/**
+	 * overwrite the given columns of the view only
+	 * @param col_idx column index relative to view
+	 */
+	void set_data(const EVENT_DATA_VEC & data_in, uvec col_idx);
 	EVENT_DATA_VEC get_data() const;
 
 	CytoFrameView copy(const string & cf_filename = "") const;
@@ -24,12 +24,48 @@ namespace cytolib
  * the rest code base and they can work when tiledb is disabled at compile time
  * no longer needed since tiledb support is dropped
  */
+	enum class H5Compression {none, deflate, lz4, zstd};
+	/**
+	 * storage layout of the events dataset when the cytoframe is written to h5
+	 *
+	 * The default (all the events of a channel in one uncompressed chunk) matches the files written by the earlier versions.
+	 * Smaller chunks along the event axis allow partial row reads to skip the unselected chunks
+	 * and keep the chunks within the h5 chunk cache. lz4 and zstd require the corresponding hdf5 filter plugins
+	 * (found through HDF5_PLUGIN_PATH) both at writing and reading.
+	 * swmr creates the file in the hdf5 1.10 format, which is required to append events to it in SWMR mode
+	 * (see H5CytoFrame::set_swmr), but can't be read by hdf5 library older than 1.10.
+	 * legacy_rownames also writes the rownames as the variable-length strings (see RowNames), which is the only form
+	 * the earlier versions read. Turning it off saves the time and space for the large frames,
+	 * but the earlier versions then see no rownames in the file.
+	 */
+	struct H5_WRITE_PARAM{
+		size_t events_per_chunk;//0 means all the events
+		size_t channels_per_chunk;
+		bool shuffle;//byte shuffle before compression, which usually improves the ratio of float events considerably
+		H5Compression compression;
+		int compression_level;//negative value uses the default level of the compressor. Not used by lz4
+		bool swmr;
+		bool legacy_rownames;
+		H5_WRITE_PARAM(){
+			events_per_chunk = 0;
+			channels_per_chunk = 1;
+			shuffle = false;
+			compression = H5Compression::none;
+			compression_level = -1;
+			swmr = false;
+			legacy_rownames = true;
+		};
+	};
 	class CytoCtx
 	{
 		string access_key_id_;
 		string access_key_;
 		string region_;
 		int num_threads_;
+		H5_WRITE_PARAM h5_write_param_;
+		bool h5_container_;
+		bool h5_lazy_load_;
+		bool shared_memory_;
 		shared_ptr<void> ctxptr_;
 		void init_ctxptr();
 	public:
@@ -52,6 +88,32 @@ namespace cytolib
 						, const string & aws_region
 						, int num_threads = 1);
 			shared_ptr<void> get_ctxptr() const{return ctxptr_;};
+			int get_num_threads() const{return num_threads_;};
+			/**
+			 * the layout used by write_to_disk, GatingSet::add_fcs etc. when writing h5
+			 */
+			const H5_WRITE_PARAM & get_h5_write_param() const{return h5_write_param_;};
+			void set_h5_write_param(const H5_WRITE_PARAM & param){h5_write_param_ = param;};
+			/**
+			 * whether GatingSet::add_fcs, serialize_pb and copy store all the cytoframes in a single h5 container
+			 * (see H5ContainerCytoFrame) instead of one h5 file per sample
+			 */
+			bool get_h5_container() const{return h5_container_;};
+			void set_h5_container(bool flag){h5_container_ = flag;};
+			/**
+			 * whether load_cytoframe (thus the GatingSet loader) only records the h5 uri and defers reading
+			 * the meta data and dims of each cytoframe until it is first accessed.
+			 * The GatingSet loader skips the channel consistency check across samples in this mode
+			 */
+			bool get_h5_lazy_load() const{return h5_lazy_load_;};
+			void set_h5_lazy_load(bool flag){h5_lazy_load_ = flag;};
+			/**
+			 * whether load_cytoframe (thus the GatingSet loader) keeps the events of the read-only h5 cytoframes
+			 * in shared memory (see SharedCytoFrame), so that the processes loading the same archive share one copy of them.
+			 * The meta data are still loaded by each process, so it overrides h5_lazy_load for these frames
+			 */
+			bool get_shared_memory() const{return shared_memory_;};
+			void set_shared_memory(bool flag){shared_memory_ = flag;};
 
 	};
 
@@ -0,0 +1,56 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * FCSCatalog.hpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_FCSCATALOG_HPP_
+#define INST_INCLUDE_CYTOLIB_FCSCATALOG_HPP_
+#include "MemCytoFrame.hpp"
+
+namespace cytolib
+{
+/**
+ * keyword table of a collection of FCS files
+ *
+ * It is stored by column: values[k][i] is the value of keywords[k] in files[i]
+ * (empty string when the file doesn't have that keyword).
+ * The keyword columns are ordered by their first appearance in files.
+ */
+struct FCS_CATALOG{
+	vector<string> files;
+	vector<string> keywords;
+	vector<vector<string>> values;
+	size_t n_parsed = 0;//the number of files parsed by the scan, the rest are served from the cache
+	/**
+	 * get the column of the given keyword
+	 * @return empty vector when the keyword is not found in any file
+	 */
+	vector<string> get_column(const string & keyword) const;
+};
+
+/**
+ * parse the header and TEXT segment of the FCS files in parallel and collect their keywords
+ *
+ * @param files FCS file paths
+ * @param config the header parsing arguments
+ * @param num_threads the number of files parsed at the same time
+ * @param cache_file when not empty, the keywords are cached in this file keyed by the path, size and modification time (in nanoseconds) of each FCS.
+ * 					Files that are unchanged since the last scan are not opened again. The cache is created if not exists and updated after each scan.
+ * 					It only keeps the files of the latest scan, i.e. the ones that are deleted or not scanned any more are dropped.
+ * 					On the file systems with coarse timestamps, a file rewritten at the same size within the same tick is served stale.
+ */
+FCS_CATALOG read_fcs_header_catalog(const vector<string> & files
+		, const FCS_READ_HEADER_PARAM & config = FCS_READ_HEADER_PARAM()
+		, int num_threads = 1
+		, const string & cache_file = "");
+/**
+ * list the FCS files (*.fcs, case insensitive) in a directory (not recursive), sorted by path
+ */
+vector<string> list_fcs_files(const string & dir);
+
+};
+
+#endif /* INST_INCLUDE_CYTOLIB_FCSCATALOG_HPP_ */
@@ -0,0 +1,92 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * FCSDecoder.hpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_FCSDECODER_HPP_
+#define INST_INCLUDE_CYTOLIB_FCSDECODER_HPP_
+#include "datatype.hpp"
+#include <cstdint>
+#include <cstring>
+#include <string>
+using namespace std;
+
+namespace cytolib
+{
+/**
+ * decode the raw values of one column from the row-major DATA segment
+ *
+ * @param src the first byte of the column in the first row to decode
+ * @param stride the number of bytes per row
+ * @param n the number of rows to decode
+ * @param mask the bitmask applied to the integer values (ignored for floating point)
+ * @param dst the output, which is contiguous (col-major)
+ */
+typedef void (*FCS_DECODER)(const char * src, size_t stride, size_t n, uint64_t mask, EVENT_DATA_TYPE * dst);
+
+inline uint8_t byteswap(uint8_t v){return v;}
+inline uint16_t byteswap(uint16_t v){return static_cast<uint16_t>((v >> 8) | (v << 8));}
+inline uint32_t byteswap(uint32_t v)
+{
+	return ((v & 0xff000000u) >> 24) | ((v & 0x00ff0000u) >> 8)
+			| ((v & 0x0000ff00u) << 8) | ((v & 0x000000ffu) << 24);
+}
+inline uint64_t byteswap(uint64_t v)
+{
+	return (static_cast<uint64_t>(byteswap(static_cast<uint32_t>(v))) << 32)
+			| byteswap(static_cast<uint32_t>(v >> 32));
+}
+
+/**
+ * kernel for unsigned integers ($DATATYPE I)
+ *
+ * Both the element type and the byte swapping are resolved at compile time so that
+ * the loop body is branch-free and can be vectorized by the compiler.
+ * memcpy is used for the (possibly unaligned) loads and compiles down to a plain move.
+ */
+template<typename UINT, bool swap>
+void decode_uint(const char * src, size_t stride, size_t n, uint64_t mask, EVENT_DATA_TYPE * dst)
+{
+	UINT m = static_cast<UINT>(mask);
+	for(size_t i = 0; i < n; i++)
+	{
+		UINT v;
+		memcpy(&v, src + i * stride, sizeof(UINT));
+		if(swap)
+			v = byteswap(v);
+		dst[i] = static_cast<EVENT_DATA_TYPE>(static_cast<UINT>(v & m));
+	}
+}
+/**
+ * kernel for floating points ($DATATYPE F or D)
+ */
+template<typename FLOAT, typename UINT, bool swap>
+void decode_float(const char * src, size_t stride, size_t n, uint64_t /*mask*/, EVENT_DATA_TYPE * dst)
+{
+	static_assert(sizeof(FLOAT) == sizeof(UINT), "the size of the integer type does not match the floating point type!");
+	for(size_t i = 0; i < n; i++)
+	{
+		UINT v;
+		memcpy(&v, src + i * stride, sizeof(UINT));
+		if(swap)
+			v = byteswap(v);
+		FLOAT f;
+		memcpy(&f, &v, sizeof(FLOAT));
+		dst[i] = static_cast<EVENT_DATA_TYPE>(f);
+	}
+}
+
+/**
+ * select the decode kernel for a column
+ *
+ * @param dattype the value of $DATATYPE
+ * @param nbytes the byte width of the column
+ * @param isbyteswap whether the byte order of the data differs from the host
+ */
+FCS_DECODER get_fcs_decoder(const string & dattype, int nbytes, bool isbyteswap);
+};
+
+#endif /* INST_INCLUDE_CYTOLIB_FCSDECODER_HPP_ */
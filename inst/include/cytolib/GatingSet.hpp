@@ -401,37 +401,27 @@ public:
 		add_fcs(map, config, fmt, cf_dir, false, ctx);
 	}
 
+	/**
+	 * parse the FCS files and add them as cytoframes
+	 *
+	 * When ctx carries more than one thread, the files are parsed by a pool of worker threads
+	 * and handed over to the calling thread through a bounded queue, which writes them to disk and reloads them.
+	 * All the HDF5 calls stay on the calling thread, and the queue limits how many parsed
+	 * MemCytoFrames are held in memory while waiting to be written.
+	 * Note that each worker may in turn use config.data.num_threads cores to decode the events.
+	 * Samples are added in the order of sample_uid_vs_file_path regardless of the number of threads.
+	 * The sample uids are validated before any file is parsed.
+	 * @param sample_uid_vs_file_path the pairs of the sample uid and the path of its FCS file
+	 * @param config the parsing arguments of the FCS files
+	 * @param fmt the backend of the cytoframes, the parsed frames are kept in memory when it is FileFormat::MEM
+	 * @param cf_dir the parent directory of the new folder that holds the cytoframe files
+	 * @param readonly whether the cytoframes are loaded back from disk as read-only
+	 * @param ctx the number of parsing threads, the h5 write parameters and whether to use the h5 container
+	 */
 	void add_fcs(const vector<pair<string,string>> & sample_uid_vs_file_path
 			, const FCS_READ_PARAM & config, FileFormat fmt, string cf_dir
 			, bool readonly = false
-			, CytoCtx ctx = CytoCtx())
-	{
-
-		fs::path cf_path;
-		if(fmt!= FileFormat::MEM)
-			cf_path = generate_cytoframe_folder(cf_dir);
-		for(const auto & it : sample_uid_vs_file_path)
-		{
-
-
-			CytoFramePtr fr_ptr(new MemCytoFrame(it.second,config));
-			//set pdata
-			fr_ptr->set_pheno_data("name", path_base_name(it.second));
-
-			dynamic_cast<MemCytoFrame&>(*fr_ptr).read_fcs();
-
-			string cf_filename = (cf_path/it.first).string();
-			if(fmt != FileFormat::MEM)
-			{
-				cf_filename += "." + fmt_to_str(fmt);
-				fr_ptr->write_to_disk(cf_filename, fmt, ctx);
-				fr_ptr = load_cytoframe(cf_filename, readonly, ctx);
-			}
-
-			add_cytoframe_view(it.first, CytoFrameView(fr_ptr));
-
-		}
-	}
+			, CytoCtx ctx = CytoCtx());
 
 	/**
 	 * Update sample id
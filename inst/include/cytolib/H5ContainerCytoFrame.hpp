@@ -0,0 +1,50 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * H5ContainerCytoFrame.hpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_H5CONTAINERCYTOFRAME_HPP_
+#define INST_INCLUDE_CYTOLIB_H5CONTAINERCYTOFRAME_HPP_
+#include <cytolib/H5CytoFrame.hpp>
+
+namespace cytolib
+{
+/**
+ * The cytoframe stored as a group of the h5 container
+ *
+ * It shares the IO of H5CytoFrame (the datasets are simply located under the sample group),
+ * so that a GatingSet of many samples only needs to open, copy and lock a single file.
+ * The file level operations (copy, archive) are done by writing the sample to the destination
+ * instead of copying the file.
+ */
+class H5ContainerCytoFrame:public H5CytoFrame{
+protected:
+	string sample_uid_;
+	/**
+	 * write the (realized) frame to the destination, which is either a sample of h5 container or a regular h5 file
+	 */
+	CytoFramePtr write_copy(const CytoFrame & fr, const string & cf_filename, bool overwrite) const;
+public:
+	/**
+	 * @param container the h5 container file
+	 * @param sample_uid the sample within the container
+	 */
+	H5ContainerCytoFrame(const string & container, const string & sample_uid, bool readonly = true, bool init = true);
+	string get_uri() const{
+		return h5_container_uri(filename_, sample_uid_);
+	}
+	CytoFramePtr copy(const string & cf_filename = "", bool overwrite = false) const;
+	CytoFramePtr copy(uvec idx, bool is_row_indexed, const string & cf_filename = "", bool overwrite = false) const;
+	CytoFramePtr copy(uvec row_idx, uvec col_idx, const string & cf_filename = "", bool overwrite = false) const;
+	void convertToPb(pb::CytoFrame & fr_pb
+			, const string & cf_filename
+			, CytoFileOption h5_opt
+			, const CytoCtx & ctx = CytoCtx()) const;
+};
+
+};
+
+#endif /* INST_INCLUDE_CYTOLIB_H5CONTAINERCYTOFRAME_HPP_ */
@@ -11,11 +11,24 @@
 #define INST_INCLUDE_CYTOLIB_H5CYTOFRAME_HPP_
 #include <cytolib/MemCytoFrame.hpp>
 #include <cytolib/global.hpp>
+#include <cytolib/H5FileCache.hpp>
 #include <boost/filesystem.hpp>
 namespace fs = boost::filesystem;
 
 namespace cytolib
 {
+/**
+ * the selected rows that are no more than this many rows apart are read from h5 as one range
+ */
+const hsize_t H5_ROW_COALESCE_GAP = 64;
+/**
+ * the scattered rows that take more hyperslab blocks (row ranges x column ranges) than this are selected differently,
+ * since h5 merges the OR'd blocks in roughly quadratic time.
+ * The entire span of the rows is read and subset in memory when at least 1/H5_ROW_SPAN_DENSITY of it is selected,
+ * otherwise the selected elements are read as points
+ */
+const hsize_t H5_MAX_SELECTION_BLOCKS = 1024;
+const hsize_t H5_ROW_SPAN_DENSITY = 16;
 /**
  * The class represents the H5 version of cytoFrame
  * It doesn't store and own the event data in memory.
@@ -24,6 +37,7 @@ namespace cytolib
 class H5CytoFrame:public CytoFrame{
 protected:
 	string filename_;
+	string group_;//the group that holds the datasets of this frame, empty means the file root
 	hsize_t dims[2];              // dataset dimensions
 	bool readonly_;//whether allow the public API to modify it, can't rely on h5 flag mechanism since
 //					its behavior is uncerntain for multiple opennings
@@ -31,14 +45,46 @@ protected:
 	bool is_dirty_params;
 	bool is_dirty_keys;
 	bool is_dirty_pdata;
+	bool swmr_;//whether the file is opened in single-writer/multiple-reader mode
+	bool is_loaded_;//whether the meta data and dims have been read from disk, see init_load
 	FileAccPropList access_plist_;//used to custom fapl, especially for s3 backend
-	EVENT_DATA_VEC read_data(uvec col_idx) const;
+	H5_CACHE_PARAM cache_param_;
+	/**
+	 * read the events of the given columns
+	 * @param row_idx the rows to read when is_row_indexed is true, otherwise all the rows are read.
+	 * 					The selection is pushed down to h5 so that only the selected ranges are transferred and converted
+	 */
+	EVENT_DATA_VEC read_data(uvec col_idx, uvec row_idx = uvec(), bool is_row_indexed = false) const;
 	int h5_flags() const{
 		if(get_readonly())
-			return H5F_ACC_RDONLY;
+			return swmr_ ? H5F_ACC_RDONLY | H5F_ACC_SWMR_READ : H5F_ACC_RDONLY;
 		else
-			return H5F_ACC_RDWR;
+			return swmr_ ? H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE : H5F_ACC_RDWR;
 	};
+	/**
+	 * get the h5 file handle from the process-wide cache instead of opening the file on every IO
+	 */
+	H5FileHandlePtr open_h5() const{
+		return H5FileCache::instance().open(filename_, h5_flags(), access_plist_, cache_param_);
+	}
+	/**
+	 * the path of the dataset of this frame within the h5 file
+	 */
+	string h5_path(const string & name) const{
+		return group_.empty() ? name : group_ + "/" + name;
+	}
+	Group h5_group(H5FileHandle & h5) const{
+		return h5.file().openGroup(group_.empty() ? "/" : group_);
+	}
+	/**
+	 * load the frame constructed without init on its first access.
+	 * The cached meta data are logically part of the file content, hence the const_cast.
+	 * It is not thread-safe, so access the lazy frame from one thread first before sharing it
+	 */
+	void ensure_meta_loaded() const{
+		if(!is_loaded_)
+			const_cast<H5CytoFrame *>(this)->init_load();
+	}
 public:
 	void flush_meta();
 	void flush_params();
@@ -46,22 +92,61 @@ public:
 	void flush_keys();
 	void flush_pheno_data();
 	void set_readonly(bool flag){
+		//release the cached handle so that the file isn't kept open with the old flag
+		if(flag != readonly_)
+			H5FileCache::instance().evict(filename_);
 		readonly_ = flag;
 	}
 	bool get_readonly() const{
 		return readonly_ ;
 	}
+	/**
+	 * change the chunk cache and read-ahead settings of this frame, which take effect from the next IO
+	 */
+	void set_h5_cache_param(const H5_CACHE_PARAM & param){
+		if(param != cache_param_)
+			H5FileCache::instance().evict(filename_);
+		cache_param_ = param;
+	}
+	const H5_CACHE_PARAM & get_h5_cache_param() const{
+		return cache_param_;
+	}
+	/**
+	 * open the file in SWMR (single-writer/multiple-reader) mode, so that the events appended by
+	 * the writer (see append_rows) can be read by other processes while the file is still open for writing.
+	 *
+	 * The writer (readonly is false) requires the file created with H5_WRITE_PARAM::swmr.
+	 * In SWMR mode the writer can only append events, the meta data and rownames can't be modified,
+	 * so call flush_meta before turning it on.
+	 * The readers (readonly is true) call refresh() to pick up the newly appended events.
+	 */
+	void set_swmr(bool flag){
+		if(flag != swmr_)
+			H5FileCache::instance().evict(filename_);
+		swmr_ = flag;
+	}
+	bool get_swmr() const{
+		return swmr_;
+	}
+	/**
+	 * reload the dimensions of the events from disk, which may have been extended by a SWMR writer
+	 */
+	void refresh();
 	FileFormat get_backend_type() const{
 			return FileFormat::H5;
 		};
 	H5CytoFrame(const H5CytoFrame & frm):CytoFrame(frm)
 	{
 		filename_ = frm.filename_;
+		group_ = frm.group_;
 		is_dirty_params = frm.is_dirty_params;
 		is_dirty_keys = frm.is_dirty_keys;
 		is_dirty_pdata = frm.is_dirty_pdata;
 		readonly_ = frm.readonly_;
+		swmr_ = frm.swmr_;
+		is_loaded_ = frm.is_loaded_;
 		access_plist_ = frm.access_plist_;
+		cache_param_ = frm.cache_param_;
 		memcpy(dims, frm.dims, sizeof(dims));
 
 	}
@@ -73,10 +158,14 @@ public:
 //		swap(channel_vs_idx, frm.channel_vs_idx);
 //		swap(marker_vs_idx, frm.marker_vs_idx);
 		swap(filename_, frm.filename_);
+		swap(group_, frm.group_);
 		swap(dims, frm.dims);
 		swap(access_plist_, frm.access_plist_);
+		swap(cache_param_, frm.cache_param_);
 
 		swap(readonly_, frm.readonly_);
+		swap(swmr_, frm.swmr_);
+		swap(is_loaded_, frm.is_loaded_);
 		swap(is_dirty_params, frm.is_dirty_params);
 		swap(is_dirty_keys, frm.is_dirty_keys);
 		swap(is_dirty_pdata, frm.is_dirty_pdata);
@@ -85,11 +174,15 @@ public:
 	{
 		CytoFrame::operator=(frm);
 		filename_ = frm.filename_;
+		group_ = frm.group_;
 		is_dirty_params = frm.is_dirty_params;
 		is_dirty_keys = frm.is_dirty_keys;
 		is_dirty_pdata = frm.is_dirty_pdata;
 		readonly_ = frm.readonly_;
+		swmr_ = frm.swmr_;
+		is_loaded_ = frm.is_loaded_;
 		access_plist_ = frm.access_plist_;
+		cache_param_ = frm.cache_param_;
 		memcpy(dims, frm.dims, sizeof(dims));
 		return *this;
 	}
@@ -97,16 +190,21 @@ public:
 	{
 		CytoFrame::operator=(frm);
 		swap(filename_, frm.filename_);
+		swap(group_, frm.group_);
 		swap(dims, frm.dims);
 		swap(is_dirty_params, frm.is_dirty_params);
 		swap(is_dirty_keys, frm.is_dirty_keys);
 		swap(is_dirty_pdata, frm.is_dirty_pdata);
 		swap(readonly_, frm.readonly_);
+		swap(swmr_, frm.swmr_);
+		swap(is_loaded_, frm.is_loaded_);
 		swap(access_plist_, frm.access_plist_);
+		swap(cache_param_, frm.cache_param_);
 		return *this;
 	}
 
 	unsigned n_rows() const{
+				ensure_meta_loaded();
 				return dims[1];
 		}
 
@@ -149,52 +247,48 @@ public:
 		return res;
 	}
 
-	void append_data_columns(const EVENT_DATA_VEC & new_cols)
+	/**
+	 * extend the events dataset along the channel axis and write the new columns only
+	 */
+	void append_data_columns(const EVENT_DATA_VEC & new_cols);
+	/**
+	 * extend the events dataset along the event axis and write the new events only
+	 *
+	 * It is meant for ingesting the events incrementally (e.g. from the partial exports of an ongoing acquisition)
+	 * without rewriting the events that are already on disk.
+	 * @param new_rows the new events, which must have the same columns as the frame
+	 * @param new_rownames the rownames of the new events, required when the frame has rownames and not allowed otherwise
+	 */
+	void append_rows(const EVENT_DATA_VEC & new_rows, const vector<string> & new_rownames = vector<string>());
+	vector<string> get_rownames() const
 	{
-		EVENT_DATA_VEC this_data = get_data();
-		this_data.insert_cols(this_data.n_cols, new_cols);
-		set_data(this_data);
+		return get_compact_rownames().to_vector();
 	}
-	vector<string> get_rownames() const
+	/**
+	 * read the rownames from disk on every call, they are not cached by the frame
+	 */
+	RowNames get_compact_rownames() const
 	{
-		vector<string> rownames;
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
-		auto dsname = DATASET_ROWNAME;
-		if(file.exists(dsname))
-		{
-			auto dataset = file.openDataSet(dsname);
-			auto dataspace = dataset.getSpace();
-
-			unsigned nrow = n_rows();
-
-			hsize_t dimsm[] = {nrow};
-			DataSpace memspace(1,dimsm);
-			StrType str_type(H5::PredType::C_S1, H5T_VARIABLE);
-
-			// HDF5 only understands vector of char* :-(
-			std::vector<char*> rn_c_str(nrow);
-			dataset.read(rn_c_str.data(), str_type ,memspace, dataspace);
-
-			for (unsigned ii = 0; ii < rn_c_str.size(); ++ii)
-				rownames.push_back(string(rn_c_str[ii]));
-
-
-		}
-		return rownames;
+		auto h5 = open_h5();
+		return RowNames::read_h5(h5_group(*h5));
 	}
 	void set_rownames(const vector<string> & rn)
 	{
-
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
+		set_compact_rownames(RowNames(rn));
+	}
+	void set_compact_rownames(const RowNames & rn)
+	{
 		check_write_permission();
-		write_h5_rownames(file, rn);
+		auto h5 = open_h5();
+		Group group = h5_group(*h5);
+		write_h5_rownames(group, rn, has_legacy_rownames(group));
+		h5->file().flush(H5F_SCOPE_LOCAL);
 	}
 	void del_rownames(){
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
 		check_write_permission();
-
-		if(file.exists(DATASET_ROWNAME))
-			file.unlink(DATASET_ROWNAME);
+		auto h5 = open_h5();
+		RowNames::remove_h5(h5_group(*h5));
+		h5->file().flush(H5F_SCOPE_LOCAL);
 	}
 	void set_marker(const string & channelname, const string & markername)
 	{
@@ -225,38 +319,66 @@ public:
 	 * constructor from FCS
 	 * @param fcs_filename
 	 * @param h5_filename
+	 * @param max_buffer_bytes when non-zero, the events are converted block by block and the memory used for the events is kept within this budget
+	 * 							instead of loading the entire FCS into memory first. It has no effect when config.data.which_lines is set.
+	 * @param h5_param the chunk layout and compression of the events
 	 */
 	H5CytoFrame(const string & fcs_filename, FCS_READ_PARAM & config, const string & h5_filename
-			, bool readonly = false):filename_(h5_filename), is_dirty_params(false), is_dirty_keys(false), is_dirty_pdata(false)
+			, bool readonly = false, size_t max_buffer_bytes = 0
+			, const H5_WRITE_PARAM & h5_param = H5_WRITE_PARAM()):filename_(h5_filename), is_dirty_params(false), is_dirty_keys(false), is_dirty_pdata(false), swmr_(false), is_loaded_(false)
 	{
 		MemCytoFrame fr(fcs_filename, config);
-		fr.read_fcs();
-		fr.write_h5(h5_filename);
+		if(max_buffer_bytes > 0 && config.data.which_lines.empty())
+			fr.read_fcs_to_h5(h5_filename, max_buffer_bytes, h5_param);
+		else
+		{
+			fr.read_fcs();
+			fr.write_h5(h5_filename, h5_param);
+		}
 		*this = H5CytoFrame(h5_filename, readonly);
 	}
 	/**
 	 * constructor from the H5
 	 * @param _filename H5 file path
+	 * @param init false to only record the file path, the meta data and dims are then loaded
+	 * 				either by init_load or on the first access (e.g. when loading a large GatingSet)
 	 */
-	H5CytoFrame(const string & h5_filename, bool readonly = true, bool init = true):CytoFrame(),filename_(h5_filename), readonly_(readonly), is_dirty_params(false), is_dirty_keys(false), is_dirty_pdata(false)
+	H5CytoFrame(const string & h5_filename, bool readonly = true, bool init = true):CytoFrame(),filename_(h5_filename), readonly_(readonly), is_dirty_params(false), is_dirty_keys(false), is_dirty_pdata(false), swmr_(false), is_loaded_(false)
 	{
 		access_plist_ = FileAccPropList::DEFAULT;
+		cache_param_ = H5FileCache::instance().get_default_cache_param();
 		if(init)//optionally delay load for the s3 derived cytoframe which needs to reset fapl before load
 			init_load();
 	}
 	void init_load(){
-		//always use the same flag and keep lock at cf level to avoid h5 open error caused conflicting h5 flags among cf objects that points to the same h5
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
-		load_meta();
+		//set it first since load_meta goes through the setters that check it
+		is_loaded_ = true;
+		try
+		{
+			//always use the same flag and keep lock at cf level to avoid h5 open error caused conflicting h5 flags among cf objects that points to the same h5
+			auto h5 = open_h5();
+			load_meta();
 
 
-		//open dataset for event data
+			//open dataset for event data
 
-		auto dataset = file.openDataSet(DATASET_NAME);
-		auto dataspace = dataset.getSpace();
-		dataspace.getSimpleExtentDims(dims);
+			auto dataset = h5->dataset(h5_path(DATASET_NAME));
+			auto dataspace = dataset.getSpace();
+			dataspace.getSimpleExtentDims(dims);
+		}
+		catch(...)
+		{
+			is_loaded_ = false;
+			throw;
+		}
 
 	}
+	/**
+	 * whether the meta data and dims have been loaded from disk
+	 */
+	bool is_loaded() const{
+		return is_loaded_;
+	}
 	/**
 	 * abandon the changes to the meta data in cache by reloading them from disk
 	 */
@@ -265,6 +387,21 @@ public:
 	string get_uri() const{
 		return filename_;
 	}
+	/**
+	 * the chunk layout and compression of the events dataset
+	 */
+	H5_WRITE_PARAM get_h5_write_param() const{
+		auto h5 = open_h5();
+		auto param = h5_events_param(h5->dataset(h5_path(DATASET_NAME)));
+		param.legacy_rownames = has_legacy_rownames(h5_group(*h5));
+		return param;
+	}
+	/**
+	 * whether the rownames are written in the legacy form as well, i.e. unless the file was written without it
+	 */
+	static bool has_legacy_rownames(const H5Location & loc){
+		return loc.exists(DATASET_ROWNAME) || !RowNames::exists_h5(loc);
+	}
 	void check_write_permission() const{
 		if(readonly_)
 			throw(domain_error("Can't write to the read-only H5CytoFrame object!"));
@@ -277,7 +414,18 @@ public:
 			, const CytoCtx & ctx = CytoCtx()) const
 	{
 			fr_pb.set_is_h5(true);
-			if(h5_opt != CytoFileOption::skip)
+			if(h5_opt != CytoFileOption::skip && is_h5_container_uri(h5_filename))
+			{
+				if(h5_opt != CytoFileOption::copy && h5_opt != CytoFileOption::move)
+					throw(logic_error("Only 'copy' or 'move' option is supported for archiving to h5 container!"));
+				write_h5_container(*this, h5_filename, get_h5_write_param());
+				if(h5_opt == CytoFileOption::move)
+				{
+					H5FileCache::instance().evict(filename_);
+					fs::remove(filename_);
+				}
+			}
+			else if(h5_opt != CytoFileOption::skip)
 			{
 				auto h5path = fs::path(h5_filename);
 				auto dest = h5path.parent_path();
@@ -286,6 +434,9 @@ public:
 
 				if(!fs::equivalent(fs::path(filename_).parent_path(), dest))
 				{
+					//close the files before touching them on disk
+					H5FileCache::instance().evict(filename_);
+					H5FileCache::instance().evict(h5_filename);
 					switch(h5_opt)
 					{
 					case CytoFileOption::copy:
@@ -346,11 +497,16 @@ public:
 		if(is_col)
 			return read_data(idx);
 		else
-			return get_data().rows(idx);
+		{
+			uvec col_idx(n_cols());
+			for(unsigned i = 0; i < col_idx.size(); i++)
+				col_idx[i] = i;
+			return read_data(col_idx, idx, true);
+		}
 	}
 	EVENT_DATA_VEC get_data(uvec row_idx, uvec col_idx) const
 	{
-		return read_data(col_idx).rows(row_idx);
+		return read_data(col_idx, row_idx, true);
 	}
 	/*
 	 * protect the h5 from being overwritten accidentally
@@ -370,6 +526,8 @@ public:
 
 	CytoFramePtr copy(const string & h5_filename = "", bool overwrite = false) const
 	{
+		if(is_h5_container_uri(h5_filename))
+			return write_h5_container(*this, h5_filename, get_h5_write_param());
 		copy_overwrite_check(h5_filename, overwrite);
 		string new_filename = h5_filename;
 		if(new_filename == "")
@@ -377,6 +535,7 @@ public:
 			new_filename = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
 			fs::remove(new_filename);
 		}
+		H5FileCache::instance().evict(filename_);
 		fs::copy_file(filename_, new_filename);
 		CytoFramePtr ptr(new H5CytoFrame(new_filename, false));
 		//copy cached meta
@@ -387,6 +546,8 @@ public:
 	}
 	CytoFramePtr copy(uvec row_idx, uvec col_idx, const string & h5_filename = "", bool overwrite = false) const
 	{
+		if(is_h5_container_uri(h5_filename))
+			return write_h5_container(*MemCytoFrame(*this).copy(row_idx, col_idx), h5_filename, get_h5_write_param());
 		copy_overwrite_check(h5_filename, overwrite);
 
 		string new_filename = h5_filename;
@@ -396,12 +557,14 @@ public:
 			fs::remove(new_filename);
 		}
 		MemCytoFrame fr(*this);
-		fr.copy(row_idx, col_idx)->write_h5(new_filename);//this flushes the meta data as well
+		fr.copy(row_idx, col_idx)->write_h5(new_filename, get_h5_write_param());//this flushes the meta data as well
 		return CytoFramePtr(new H5CytoFrame(new_filename, false));
 	}
 
 	CytoFramePtr copy(uvec idx, bool is_row_indexed, const string & h5_filename = "", bool overwrite = false) const
 	{
+		if(is_h5_container_uri(h5_filename))
+			return write_h5_container(*MemCytoFrame(*this).copy(idx, is_row_indexed), h5_filename, get_h5_write_param());
 		copy_overwrite_check(h5_filename, overwrite);
 
 		string new_filename = h5_filename;
@@ -411,7 +574,7 @@ public:
 			fs::remove(new_filename);
 		}
 		MemCytoFrame fr(*this);
-		fr.copy(idx, is_row_indexed)->write_h5(new_filename);//this flushes the meta data as well
+		fr.copy(idx, is_row_indexed)->write_h5(new_filename, get_h5_write_param());//this flushes the meta data as well
 		return CytoFramePtr(new H5CytoFrame(new_filename, false));
 	}
 
@@ -426,6 +589,10 @@ public:
 		check_write_permission();
 		set_data(_data);
 	}
+	/**
+	 * write the given columns only, the contiguous columns are written as one hyperslab
+	 */
+	void set_data(const EVENT_DATA_VEC & data_in, uvec col_idx);
 
 //	vector<string> get_rownames() const
 //	{
@@ -0,0 +1,194 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * H5FileCache.hpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_H5FILECACHE_HPP_
+#define INST_INCLUDE_CYTOLIB_H5FILECACHE_HPP_
+#include <H5Cpp.h>
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+using namespace std;
+using namespace H5;
+
+namespace cytolib
+{
+/**
+ * the default number of h5 files kept open by H5FileCache
+ */
+const size_t H5_FILE_CACHE_CAPACITY = 32;
+
+/**
+ * the access pattern hinted to the OS for the h5 file (posix_fadvise), which controls its read-ahead.
+ * macOS only supports turning the read-ahead off for random
+ * prefetch asks the OS to start reading the entire file into the page cache as soon as it is opened
+ */
+enum class H5ReadAhead {normal, sequential, random, prefetch};
+/**
+ * raw data chunk cache (rdcc) and read-ahead settings applied when the h5 file and its datasets are opened
+ *
+ * Each open dataset gets its own chunk cache of rdcc_nbytes. The default matches the hdf5 library default (1MB),
+ * which is smaller than a single {1, nEvents} chunk of most files, so the chunks are never actually cached.
+ * Make it larger than the chunks of the channels that are read repeatedly to avoid reading and decompressing them again.
+ */
+struct H5_CACHE_PARAM{
+	size_t rdcc_nbytes;//total size of the chunk cache of each dataset
+	size_t rdcc_nslots;//number of the hash slots, preferably a prime about 100 times of the number of chunks that fit in the cache
+	double rdcc_w0;//preemption policy between 0 and 1, 1 evicts the chunks that have been fully read first
+	H5ReadAhead read_ahead;
+	/*
+	 * read the entire columns of the unfiltered events straight from the chunks (H5Dread_chunk) into the result,
+	 * bypassing the chunk cache, the selection and the type conversion of hdf5.
+	 * It is off by default until it gets more use, since it bypasses hdf5 for the layouts it accepts.
+	 * It only affects how the data is read, so it is not part of the cached file handle (see operator==)
+	 */
+	bool direct_chunk_read;
+	H5_CACHE_PARAM(){
+		rdcc_nbytes = 1024 * 1024;
+		rdcc_nslots = 521;
+		rdcc_w0 = 0.75;
+		read_ahead = H5ReadAhead::normal;
+		direct_chunk_read = false;
+	};
+	bool operator==(const H5_CACHE_PARAM & other) const{
+		return rdcc_nbytes == other.rdcc_nbytes && rdcc_nslots == other.rdcc_nslots
+				&& rdcc_w0 == other.rdcc_w0 && read_ahead == other.read_ahead;
+	}
+	bool operator!=(const H5_CACHE_PARAM & other) const{return !(*this == other);}
+};
+
+/**
+ * An open h5 file along with the datasets that have been opened from it
+ *
+ * Only the datasets that are never unlinked (events and meta data) should be accessed through dataset(),
+ * the others (e.g. rownames) are opened from file() directly so that no stale handle is kept around.
+ * The group that is about to be unlinked (e.g. a sample of the h5 container) must have its datasets released first.
+ */
+class H5FileHandle{
+	H5File file_;
+	unordered_map<string, DataSet> datasets_;//declared after file_ so that they are closed first
+	DSetAccPropList dataset_plist_;
+	mutex mutex_;
+public:
+	H5FileHandle(const string & filename, unsigned flags, const FileAccPropList & access_plist
+			, const H5_CACHE_PARAM & cache_param = H5_CACHE_PARAM());
+	H5FileHandle(const H5FileHandle &) = delete;
+	H5FileHandle & operator=(const H5FileHandle &) = delete;
+
+	H5File & file(){return file_;}
+	/**
+	 * open the dataset once and reuse it on the subsequent calls
+	 */
+	DataSet dataset(const string & name);
+	/**
+	 * close the cached datasets under the given group
+	 */
+	void release_datasets(const string & group);
+};
+typedef shared_ptr<H5FileHandle> H5FileHandlePtr;
+
+/**
+ * the identity and the state of the file on disk, used to tell whether it has changed since it was opened
+ */
+struct H5FileStamp{
+	uint64_t dev = 0;
+	uint64_t ino = 0;
+	uint64_t size = 0;
+	int64_t mtime = 0;//in nanoseconds
+	bool valid = false;//false when the file can't be stat (e.g. remote file)
+	static H5FileStamp of(const string & filename);
+	/**
+	 * whether the path refers to a different file now, e.g. it has been replaced by rename
+	 */
+	bool is_replaced_by(const H5FileStamp & other) const{
+		return valid && other.valid && (dev != other.dev || ino != other.ino);
+	}
+	bool is_modified_by(const H5FileStamp & other) const{
+		return is_replaced_by(other) || (valid && other.valid && (size != other.size || mtime != other.mtime));
+	}
+};
+
+/**
+ * Process-wide LRU cache of the open h5 files, so that the repeated IO on the same H5CytoFrame
+ * doesn't pay for opening the file (superblock read, metadata cache warm-up, file locking) every time.
+ *
+ * The cache is keyed by the canonical file path. A file opened for read-write also serves the read-only requests
+ * (the write permission is checked at cytoframe level anyway), whereas a read-write request on a file
+ * cached as read-only reopens it.
+ * The handles are shared_ptr, so the one evicted while still in use is closed only when its last user releases it.
+ * hdf5 refuses to open the file again with the conflicting flags while it is still open,
+ * so such request fails (domain_error) until the handle in use is released.
+ *
+ * Unlike opening the file per call, the cached file stays open (and locked by hdf5 file locking) between the calls.
+ * As for the other processes:
+ * - their writers can't open the file (hdf5 file locking) until it is closed here by evict(), clear() or set_capacity(0)
+ * - the file they replace (e.g. by rename) or modify (with file locking disabled) is detected by its inode, size and
+ *   modification time, the read-only handle is then reopened on the next request instead of serving the stale metadata.
+ *   The read-write and SWMR read handles are only reopened when the file is replaced,
+ *   since the file is expected to be modified by their own writes or by the SWMR writer (see H5CytoFrame::refresh)
+ * All the members are thread-safe, but the h5 IO through the returned handles is only safe
+ * when the hdf5 library is built with thread-safety.
+ */
+class H5FileCache{
+	struct Entry{
+		string filename;
+		unsigned flags;
+		H5_CACHE_PARAM cache_param;
+		H5FileHandlePtr handle;
+		H5FileStamp stamp;//of the file when it was opened
+	};
+	list<Entry> lru_;//most recently used first
+	unordered_map<string, list<Entry>::iterator> index_;
+	size_t capacity_;
+	H5_CACHE_PARAM default_cache_param_;
+	mutable mutex mutex_;
+	H5FileCache():capacity_(H5_FILE_CACHE_CAPACITY){}
+	void erase(const string & filename);
+	void trim();
+public:
+	static H5FileCache & instance();
+	/**
+	 * get the open handle of the file, open it if it is not cached yet
+	 * @param filename h5 file path
+	 * @param flags H5F_ACC_RDONLY or H5F_ACC_RDWR, optionally combined with the SWMR flags
+	 * @param access_plist only used when the file is actually opened
+	 * @param cache_param the file cached with different chunk cache settings is reopened
+	 * @throws domain_error when the cached handle doesn't serve the flags and is still in use
+	 */
+	H5FileHandlePtr open(const string & filename, unsigned flags, const FileAccPropList & access_plist = FileAccPropList::DEFAULT
+			, const H5_CACHE_PARAM & cache_param = H5_CACHE_PARAM());
+	/**
+	 * close the cached handle of the file (once it is no longer in use), e.g. to let the other processes write to it.
+	 * It must be called before the file is overwritten, moved or deleted
+	 */
+	void evict(const string & filename);
+	/**
+	 * close all the cached handles (once they are no longer in use)
+	 */
+	void clear();
+	/**
+	 * set the maximum number of the files kept open. 0 disables caching, i.e. every open() opens the file again
+	 */
+	void set_capacity(size_t n);
+	size_t get_capacity() const;
+	/**
+	 * the chunk cache settings the new H5CytoFrame objects start with
+	 */
+	void set_default_cache_param(const H5_CACHE_PARAM & param);
+	H5_CACHE_PARAM get_default_cache_param() const;
+	/**
+	 * the number of files currently cached
+	 */
+	size_t size() const;
+};
+
+};
+
+#endif /* INST_INCLUDE_CYTOLIB_H5FILECACHE_HPP_ */
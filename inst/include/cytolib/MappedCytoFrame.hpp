@@ -0,0 +1,106 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * MappedCytoFrame.hpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_MAPPEDCYTOFRAME_HPP_
+#define INST_INCLUDE_CYTOLIB_MAPPEDCYTOFRAME_HPP_
+#include <cytolib/MemCytoFrame.hpp>
+#include <cytolib/MappedFile.hpp>
+
+namespace cytolib
+{
+/**
+ * The cytoframe whose events are memory mapped from disk
+ *
+ * The events file (<name>.mmap) holds the raw events of the in-memory precision as one col-major block,
+ * i.e. each channel is a contiguous region of the file, and the mapping starts at the page boundary.
+ * The sidecar (<name>.mmap.meta) is a h5 file that holds the meta data along with the events dataset
+ * that points to the events file as its external storage, so it can also be read as a regular H5CytoFrame.
+ *
+ * The events matrix refers to the mapped pages directly, so get_data_memptr and the gating APIs
+ * (which take MemCytoFrame) run on the page cache without read or copy,
+ * and the processes mapping the same file share one physical copy of the events.
+ * The mapping is copy-on-write: the in-place changes (e.g. transform_data) stay private to the process,
+ * whereas set_data writes the new events file and maps it again.
+ * The copies (by copy constructor) share the mapping, call copy() for an independent frame.
+ */
+class MappedCytoFrame:public MemCytoFrame{
+protected:
+	string uri_;//the events file
+	bool readonly_;
+	shared_ptr<MappedFile> mapped_;
+	/**
+	 * map the events file and let data_ refer to it
+	 */
+	void map_events(hsize_t nrow, hsize_t ncol);
+	/**
+	 * write the (realized) frame to the destination, which is either a memory mapped file or a sample of h5 container
+	 */
+	CytoFramePtr write_copy(const CytoFrame & fr, const string & cf_filename, bool overwrite) const;
+public:
+	/**
+	 * @param filename the events file
+	 */
+	MappedCytoFrame(const string & filename, bool readonly = true);
+	MappedCytoFrame(const MappedCytoFrame & frm);
+	MappedCytoFrame(MappedCytoFrame && frm);
+	MappedCytoFrame & operator=(const MappedCytoFrame & frm);
+	MappedCytoFrame & operator=(MappedCytoFrame && frm);
+
+	FileFormat get_backend_type() const{
+		return FileFormat::MMAP;
+	}
+	string get_uri() const{
+		return uri_;
+	}
+	void set_readonly(bool flag){
+		readonly_ = flag;
+	}
+	bool get_readonly() const{
+		return readonly_;
+	}
+	void check_write_permission() const{
+		if(readonly_)
+			throw(domain_error("Can't write to the read-only MappedCytoFrame object!"));
+	}
+	/**
+	 * whether the events are served from the mapped pages, which is not the case on the platforms without mmap
+	 * or when the events file has the other precision than the in-memory events (see CYTOLIB_FLOAT_EVENTS)
+	 */
+	bool is_mapped() const{
+		return mapped_ && data_.n_elem > 0 && data_.memptr() == reinterpret_cast<const EVENT_DATA_TYPE *>(mapped_->data());
+	}
+	/**
+	 * write the meta data (params, keywords, pheno data and rownames) to the sidecar
+	 */
+	void flush_meta();
+	/**
+	 * abandon the changes to the meta data by reloading them from the sidecar
+	 */
+	void load_meta();
+
+	void set_data(const EVENT_DATA_VEC & _data);
+	void set_data(EVENT_DATA_VEC && _data)
+	{
+		check_write_permission();
+		set_data(_data);
+	}
+	void set_data(const EVENT_DATA_VEC & data_in, uvec col_idx);
+	void append_data_columns(const EVENT_DATA_VEC & new_cols);
+
+	CytoFramePtr copy(const string & cf_filename = "", bool overwrite = false) const;
+	CytoFramePtr copy(uvec idx, bool is_row_indexed, const string & cf_filename = "", bool overwrite = false) const;
+	CytoFramePtr copy(uvec row_idx, uvec col_idx, const string & cf_filename = "", bool overwrite = false) const;
+	void convertToPb(pb::CytoFrame & fr_pb
+			, const string & cf_filename
+			, CytoFileOption h5_opt
+			, const CytoCtx & ctx = CytoCtx()) const;
+};
+
+};
+
+#endif /* INST_INCLUDE_CYTOLIB_MAPPEDCYTOFRAME_HPP_ */
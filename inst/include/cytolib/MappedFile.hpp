@@ -0,0 +1,65 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * MappedFile.hpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_MAPPEDFILE_HPP_
+#define INST_INCLUDE_CYTOLIB_MAPPEDFILE_HPP_
+#include <string>
+#include <cstdint>
+#include <cstddef>
+using namespace std;
+
+namespace cytolib
+{
+/**
+ * RAII wrapper around a private memory mapping of a byte range of a file
+ *
+ * The mapping is read-only by default, the caller copies the bytes it needs to modify (e.g. byte order fix).
+ * The writable mapping is copy-on-write, so the changes never reach the file on disk
+ * and only the pages that are actually modified get a private copy.
+ */
+class MappedFile{
+	void * addr_;//start of the page-aligned mapping
+	size_t map_len_;
+	char * data_;//start of the requested range within the mapping
+	size_t size_;
+public:
+	/**
+	 * map the given byte range of the file
+	 * @param filename the file path
+	 * @param offset the beginning of the range (does not need to be page-aligned)
+	 * @param length the number of bytes requested. It is truncated to the end of the file
+	 * @param writable whether the bytes can be modified in place (copy-on-write)
+	 */
+	MappedFile(const string & filename, int64_t offset, int64_t length, bool writable = false);
+	~MappedFile();
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+
+	char * data() const{return data_;}
+	/**
+	 * the number of bytes actually mapped, which can be less than the requested length
+	 * when the file is shorter than expected (e.g. truncated data section)
+	 */
+	size_t size() const{return size_;}
+	/**
+	 * hint the kernel that the pages will be accessed sequentially so that it can read ahead aggressively
+	 */
+	void advise_sequential() const;
+	/**
+	 * hint the kernel that the pages will be accessed at random so that read-ahead is disabled
+	 */
+	void advise_random() const;
+	/**
+	 * whether memory mapping is supported on current platform
+	 */
+	static bool is_supported();
+};
+
+};
+
+#endif /* INST_INCLUDE_CYTOLIB_MAPPEDFILE_HPP_ */
@@ -12,9 +12,15 @@
 #include "CytoFrame.hpp"
 #include "trans_group.hpp"
 #include "readFCSdata.hpp"
+#include <functional>
 
 namespace cytolib
 {
+/**
+ * the callback that receives the events decoded by MemCytoFrame::read_fcs_data one block at a time
+ * block holds the decoded events (col-major) and row_offset is the index of its first event in the DATA segment
+ */
+typedef function<void(const EVENT_DATA_VEC & block, size_t row_offset)> FCS_BLOCK_WRITER;
 /**
  * the container that stores the different FCS parse arguments
  */
@@ -27,8 +33,10 @@ struct FCS_READ_PARAM{
  * The class represents the in-memory version of CytoFrame, which stores and owns the events data
  */
 class MemCytoFrame: public CytoFrame{
+protected:
 	EVENT_DATA_VEC data_;//col-major
-	vector<string> rownames_;
+	RowNames rownames_;
+private:
 	// below are cached for fcs parsing, should be of no usage once the data section is parsed
 	string filename_;
 	FCS_READ_PARAM config_;
@@ -36,7 +44,7 @@ class MemCytoFrame: public CytoFrame{
 	ifstream in_;//because of this member, the class needs to explicitly define copy/assignment constructor
 
 	void parse_fcs_header(ifstream &in, int nOffset = 0);
-	void string_to_keywords(string txt, bool emptyValue);
+	void string_to_keywords(string & txt, bool emptyValue);
 	void parse_fcs_text_section(ifstream &in, bool emptyValue);
 	void open_fcs_file();
 
@@ -54,7 +62,7 @@ public:
 	MemCytoFrame(const CytoFrame & frm):CytoFrame(frm)
 	{
 		data_ = frm.get_data();
-		rownames_ = frm.get_rownames();
+		rownames_ = frm.get_compact_rownames();
 	}
 	/**
 	 * Constructor from the FCS file
@@ -84,8 +92,20 @@ public:
 	 *
 	 * @param in (input) file stream object opened from FCS file
 	 * @param config (input) the parsing arguments for data
+	 * @param max_block_rows (input) the number of events read and decoded at a time when block_writer is given
+	 * @param block_writer (input) when given, the decoded events are handed over to it block by block instead of being stored in this frame.
+	 * 						params and keywords are still updated as usual once all the blocks are processed. which_lines is not supported in this mode.
+	 */
+	void read_fcs_data(ifstream &in, const FCS_READ_DATA_PARAM & config
+			, size_t max_block_rows = 0, const FCS_BLOCK_WRITER & block_writer = FCS_BLOCK_WRITER());
+	/**
+	 * parse the FCS and write it to H5 block by block, without ever holding the entire events matrix in memory
+	 *
+	 * @param h5_filename the path of the output H5 file
+	 * @param max_buffer_bytes the memory budget for the raw and the decoded events of a block
+	 * @param param the chunk layout and compression of the events. When events_per_chunk is 0, each block is written as one chunk
 	 */
-	void read_fcs_data(ifstream &in, const FCS_READ_DATA_PARAM & config);
+	void read_fcs_to_h5(const string & h5_filename, size_t max_buffer_bytes, const H5_WRITE_PARAM & param = H5_WRITE_PARAM());
 	void read_fcs_header();
 	/**
 	 * parse the FCS header and Text segment
@@ -130,14 +150,9 @@ public:
 	void realize_(uvec idx, bool is_row_indexed);
 	void subset_rownames(uvec row_idx)
 	{
+		//realized so that the storage of all the rows is released
 		if(rownames_.size() > 0)
-		{
-			auto n = row_idx.size();
-			vector<string> tmp(n);
-			for(unsigned i = 0; i < n; i++)
-				tmp[i] = rownames_[row_idx[i]];
-			rownames_ = tmp;
-		}
+			rownames_ = rownames_.subset(row_idx).realize();
 	}
 	/**
  * Caller will receive a copy of data
@@ -145,15 +160,23 @@ public:
  */
 	vector<string> get_rownames() const
 	{
-		return rownames_;
+		return rownames_.to_vector();
 	}
 	void set_rownames(const vector<string> & data_in)
+	{
+		set_compact_rownames(RowNames(data_in));
+	}
+	RowNames get_compact_rownames() const
+	{
+		return rownames_;
+	}
+	void set_compact_rownames(const RowNames & data_in)
 	{
 		if(n_rows()!=data_in.size())
 			throw(domain_error("the input rownames size is different from the matrix size!"));
 		rownames_ = data_in;
 	}
-	void del_rownames(){rownames_.clear();}
+	void del_rownames(){rownames_ = RowNames();}
 	EVENT_DATA_VEC get_data() const
 	{
 		return data_;
@@ -162,6 +185,10 @@ public:
 	{
 		return data_;
 	}
+	const EVENT_DATA_VEC & get_data_ref() const
+	{
+		return data_;
+	}
 
 
 	EVENT_DATA_VEC get_data(uvec idx, bool is_col) const
@@ -192,6 +219,11 @@ public:
 	{
 		swap(data_, _data);
 	}
+	void set_data(const EVENT_DATA_VEC & data_in, uvec col_idx)
+	{
+		check_set_data_cols(data_in, col_idx);
+		data_.cols(col_idx) = data_in;
+	}
 	/**
 	 * return the pointer of a particular data column
 	 *
@@ -0,0 +1,153 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * RowNames.hpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_ROWNAMES_HPP_
+#define INST_INCLUDE_CYTOLIB_ROWNAMES_HPP_
+#include <cytolib/armadillo>
+#include <H5Cpp.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+using namespace std;
+using namespace H5;
+
+namespace cytolib
+{
+/**
+ * the h5 datasets of the rownames.
+ * rownames holds the variable-length strings, which is the only one understood by the earlier versions.
+ * The compact ones are counter, ids or pool (only one of them is present):
+ * counter holds {start, count}, ids holds the integers and both carry the prefix as attribute.
+ * pool holds the names concatenated and offsets holds the start of each name followed by the end of the last one.
+ * Both rownames and the compact one are written by default, see H5_WRITE_PARAM::legacy_rownames
+ */
+const H5std_string DATASET_ROWNAME("rownames");
+const H5std_string DATASET_ROWNAME_COUNTER("rownames_counter");
+const H5std_string DATASET_ROWNAME_IDS("rownames_ids");
+const H5std_string DATASET_ROWNAME_POOL("rownames_pool");
+const H5std_string DATASET_ROWNAME_OFFSETS("rownames_offsets");
+
+/**
+ * Compact rownames of the cytoframe
+ *
+ * Instead of a string per event, the names are stored in one of the encodings below
+ * and each string is only created when it is accessed:
+ * counter: prefix followed by the consecutive integers, e.g. "1", "2", ... or "cell_0", "cell_1", ...
+ * ids: prefix followed by the arbitrary integers (in canonical decimal form)
+ * pool: the names concatenated into a single buffer along with their offsets
+ * The encoding of the names given as strings is detected by the constructor.
+ *
+ * The storage is immutable and shared by the copies and subsets,
+ * the subset only holds the row indices into it.
+ */
+class RowNames{
+public:
+	enum class Encoding {counter, ids, pool};
+private:
+	struct Store{
+		Encoding encoding;
+		string prefix;
+		int64_t start;//first integer of the counter
+		uint64_t count;//number of the names of the counter
+		vector<int64_t> ids;
+		string pool;
+		vector<uint64_t> offsets;
+		uint64_t size() const;
+		void append_name(uint64_t i, string & out) const;
+	};
+	shared_ptr<const Store> store_;
+	bool is_indexed_;
+	arma::uvec idx_;
+	uint64_t store_index(uint64_t i) const{
+		return is_indexed_ ? idx_[i] : i;
+	}
+	RowNames(shared_ptr<const Store> store);
+	/**
+	 * counter when the integers are consecutive, ids otherwise
+	 */
+	static RowNames encode_ids(vector<int64_t> ids, const string & prefix);
+	/**
+	 * the integer and the prefix of each name, or false when any of them is not of that form
+	 */
+	bool as_ids(string & prefix, vector<int64_t> & ids) const;
+	/**
+	 * append the names to the pool along with their offsets
+	 */
+	void append_pool(string & pool, vector<uint64_t> & offsets) const;
+	void write_h5_compact(const H5Location & loc) const;
+	void append_h5_compact(const H5Location & loc) const;
+public:
+	RowNames();
+	/**
+	 * encode the names
+	 */
+	RowNames(const vector<string> & names);
+	static RowNames counter(uint64_t n, int64_t start = 1, const string & prefix = "");
+	static RowNames from_ids(vector<int64_t> ids, const string & prefix = "");
+	/**
+	 * @param offsets the start of each name within the pool followed by the end of the last one
+	 */
+	static RowNames from_pool(string pool, vector<uint64_t> offsets);
+
+	uint64_t size() const{
+		if(!store_)
+			return 0;
+		return is_indexed_ ? idx_.n_elem : store_->size();
+	}
+	bool empty() const{return size() == 0;}
+	string operator[](uint64_t i) const;
+	/**
+	 * all the names as strings
+	 */
+	vector<string> to_vector() const;
+	/**
+	 * the names of the selected rows, which shares the storage instead of copying the names
+	 */
+	RowNames subset(const arma::uvec & idx) const;
+	/**
+	 * the names of this followed by the ones of the other
+	 */
+	RowNames concat(const RowNames & other) const;
+	/**
+	 * the same names in its own storage without the row indices, e.g. to release the storage of the full frame
+	 */
+	RowNames realize() const;
+	/**
+	 * the encoding of the storage
+	 */
+	Encoding get_encoding() const;
+	bool is_indexed() const{return is_indexed_;}
+	bool operator==(const RowNames & other) const;
+	bool operator!=(const RowNames & other) const{return !(*this == other);}
+
+	/**
+	 * whether the rownames (of any encoding including the legacy variable-length strings) exist under the location
+	 */
+	static bool exists_h5(const H5Location & loc);
+	static void remove_h5(const H5Location & loc);
+	/**
+	 * replace the rownames under the location
+	 * @param legacy whether to also write the variable-length strings for the earlier versions
+	 */
+	void write_h5(const H5Location & loc, bool legacy = true) const;
+	/**
+	 * read the rownames under the location, the legacy variable-length strings are encoded upon reading.
+	 * The compact ones are preferred unless the legacy ones were appended by the earlier versions since
+	 */
+	static RowNames read_h5(const H5Location & loc);
+	/**
+	 * append the names to each of the rownames datasets under the location (they are written when there is none).
+	 * The compact ones are extended when the encoding allows, otherwise they are written again
+	 */
+	void append_h5(const H5Location & loc) const;
+};
+
+};
+
+#endif /* INST_INCLUDE_CYTOLIB_ROWNAMES_HPP_ */
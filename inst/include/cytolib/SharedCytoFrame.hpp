@@ -0,0 +1,90 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * SharedCytoFrame.hpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_SHAREDCYTOFRAME_HPP_
+#define INST_INCLUDE_CYTOLIB_SHAREDCYTOFRAME_HPP_
+#include <cytolib/MemCytoFrame.hpp>
+#include <cytolib/SharedMemory.hpp>
+
+namespace cytolib
+{
+/**
+ * The cytoframe whose events are held in shared memory, so that the processes working on the same archive
+ * keep a single copy of the events per node instead of one per process
+ *
+ * The segment is keyed by the uri of the source frame (along with the size and modification time of its file),
+ * the first process loading the frame reads the events from disk into it and the others simply attach to it.
+ * It is removed when the last frame (of all processes) attached to it is destroyed.
+ *
+ * The events matrix refers to the shared pages directly, so the gating APIs (which take MemCytoFrame)
+ * run on them without copy. The mapping is copy-on-write: the changes to the events or the meta data
+ * stay private to the process and are only persisted by archiving with the copy option.
+ * The copies (by copy constructor) share the segment, call copy() for an independent frame (written to h5 like H5CytoFrame::copy).
+ */
+class SharedCytoFrame:public MemCytoFrame{
+protected:
+	CytoFramePtr src_;//the frame on disk, which the meta data are loaded from
+	shared_ptr<SharedMemory> shm_;
+	/**
+	 * write the (realized) frame to the destination, which is either a h5 file or a sample of h5 container
+	 * @param overwrite whether to replace the existing h5 file, the source file is never replaced
+	 */
+	CytoFramePtr write_copy(const CytoFrame & fr, const string & cf_filename, bool overwrite) const;
+public:
+	/**
+	 * @param src the frame loaded from disk. Its events are only read by the process creating the segment
+	 */
+	SharedCytoFrame(CytoFramePtr src);
+	SharedCytoFrame(const SharedCytoFrame & frm);
+	SharedCytoFrame(SharedCytoFrame && frm);
+	SharedCytoFrame & operator=(const SharedCytoFrame & frm);
+	SharedCytoFrame & operator=(SharedCytoFrame && frm);
+
+	/**
+	 * the backend of the source frame, which is how the frame is archived
+	 */
+	FileFormat get_backend_type() const{
+		return src_->get_backend_type();
+	}
+	string get_uri() const{
+		return src_->get_uri();
+	}
+	/**
+	 * whether the events are served from the shared segment, which is not the case once they are resized (e.g. append_columns)
+	 */
+	bool is_shared() const{
+		return shm_ && data_.n_elem > 0 && data_.memptr() == reinterpret_cast<const EVENT_DATA_TYPE *>(shm_->data());
+	}
+	/**
+	 * the number of the frames (of all processes) attached to the shared events
+	 */
+	unsigned get_ref_count() const{
+		return shm_ ? shm_->ref_count() : 0;
+	}
+	/**
+	 * the name of the shared memory segment for the frame loaded from the uri
+	 */
+	static string shared_memory_name(const string & uri);
+	/**
+	 * remove the shared events of the uri regardless of the frames attached to it,
+	 * e.g. the one left behind by a process that crashed
+	 */
+	static void remove_shared_memory(const string & uri);
+
+	CytoFramePtr copy(const string & cf_filename = "", bool overwrite = false) const;
+	CytoFramePtr copy(uvec idx, bool is_row_indexed, const string & cf_filename = "", bool overwrite = false) const;
+	CytoFramePtr copy(uvec row_idx, uvec col_idx, const string & cf_filename = "", bool overwrite = false) const;
+	void convertToPb(pb::CytoFrame & fr_pb
+			, const string & cf_filename
+			, CytoFileOption h5_opt
+			, const CytoCtx & ctx = CytoCtx()) const;
+};
+
+};
+
+#endif /* INST_INCLUDE_CYTOLIB_SHAREDCYTOFRAME_HPP_ */
@@ -0,0 +1,85 @@
+/* Copyright 2019 Fred Hutchinson Cancer Research Center
+ * See the included LICENSE file for details on the license that is granted to the
+ * user of this software.
+ * SharedMemory.hpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INST_INCLUDE_CYTOLIB_SHAREDMEMORY_HPP_
+#define INST_INCLUDE_CYTOLIB_SHAREDMEMORY_HPP_
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+using namespace std;
+
+namespace cytolib
+{
+/**
+ * RAII wrapper around a named POSIX shared memory segment that is populated once and then attached by the other processes
+ *
+ * The first process creating the segment fills it through the populate callback while holding an exclusive lock on it,
+ * the others block on the lock until it is populated.
+ * The segment keeps a reference count of the attached objects (across processes) in its first page
+ * and it is unlinked as soon as the last one detaches.
+ * The data is mapped copy-on-write, so the in-place changes stay private to the process,
+ * whereas the unmodified pages are shared by all the processes attached to it.
+ *
+ * The segment left behind by a process that is killed while attached is not reclaimed until remove() is called
+ * (or the machine reboots). The one whose creator dies before populating it is detected and recreated by the next process.
+ * The segment is only unlinked while its name still refers to it, so the one recreated under the same name is never removed by the stale one.
+ * The synchronization relies on flock of the segment, hence it is not supported on macOS where flock fails on it.
+ */
+class SharedMemory{
+	string name_;
+	void * header_;//the shared control block at the beginning of the segment
+	void * addr_;//private mapping of the data
+	size_t size_;
+	bool is_creator_;
+	uint64_t dev_, ino_;//identity of the segment, which outlives its name
+	void create(int fd, const function<void(char *)> & populate);
+	bool attach(int fd);
+	void map_data(int fd);
+	void detach();
+public:
+	/**
+	 * attach the segment, create and populate it when it doesn't exist yet
+	 * @param name the segment name (see name_from_key)
+	 * @param size the number of the data bytes, which must match the size of the existing segment
+	 * @param populate writes the data to the given buffer of size bytes. It is only called by the creator
+	 */
+	SharedMemory(const string & name, size_t size, const function<void(char *)> & populate);
+	~SharedMemory();
+	SharedMemory(const SharedMemory &) = delete;
+	SharedMemory & operator=(const SharedMemory &) = delete;
+
+	char * data() const{return static_cast<char *>(addr_);}
+	size_t size() const{return size_;}
+	const string & name() const{return name_;}
+	/**
+	 * whether the segment was created (and populated) by this object instead of attached
+	 */
+	bool is_creator() const{return is_creator_;}
+	/**
+	 * the number of the objects (of all processes) currently attached to the segment
+	 */
+	unsigned ref_count() const;
+	/**
+	 * the portable segment name derived from an arbitrary key (e.g. file path)
+	 */
+	static string name_from_key(const string & key);
+	/**
+	 * unlink the segment regardless of its reference count, e.g. the one leaked by a crashed process.
+	 * The processes still attached to it are not affected
+	 */
+	static void remove(const string & name);
+	/**
+	 * whether POSIX shared memory is supported on current platform
+	 */
+	static bool is_supported();
+};
+
+};
+
+#endif /* INST_INCLUDE_CYTOLIB_SHAREDMEMORY_HPP_ */
@@ -53,7 +53,7 @@ public:
 	 * API provided for Rcpp to access calibration table
 	 */
 	Spline_Coefs getSplineCoefs();
-	void transforming(double * input, int nSize);
+	void transforming(EVENT_DATA_TYPE * input, int nSize);
 	void convertToPb(pb::calibrationTable & cal_pb);
 
 	calibrationTable(const pb::calibrationTable & cal_pb);
@@ -14,6 +14,15 @@ namespace cytolib
 {
 
 
+	/*
+	 * the in-memory type of the events. h5 always stores them as float,
+	 * so building with CYTOLIB_FLOAT_EVENTS halves the memory of the loaded frames and reads h5 without conversion.
+	 * The transformation tables and the spillover decomposition stay in double either way
+	 */
+#ifdef CYTOLIB_FLOAT_EVENTS
+	typedef float EVENT_DATA_TYPE;
+#else
 	typedef double EVENT_DATA_TYPE;
+#endif
 }
 #endif /* INST_INCLUDE_CYTOLIB_DATATYPE_HPP_ */
@@ -673,25 +673,25 @@ public:
 		{
 			case Q1:
 			{
-				verts[0] = {-numeric_limits<double>::infinity(), p.y};//bottom left
-				verts[1] = {p.x, numeric_limits<double>::infinity()};//top right
+				verts[0] = {-numeric_limits<EVENT_DATA_TYPE>::infinity(), p.y};//bottom left
+				verts[1] = {p.x, numeric_limits<EVENT_DATA_TYPE>::infinity()};//top right
 				break;
 			}
 			case Q2:
 			{
 				verts[0] = {p.x, p.y};//bottom left
-				verts[1] = {numeric_limits<double>::infinity(), numeric_limits<double>::infinity()};//top right
+				verts[1] = {numeric_limits<EVENT_DATA_TYPE>::infinity(), numeric_limits<EVENT_DATA_TYPE>::infinity()};//top right
 				break;
 			}
 			case Q3:
 			{
-				verts[0] = {p.x, -numeric_limits<double>::infinity()};//bottom left
-				verts[1] = {numeric_limits<double>::infinity(), p.y};//top right
+				verts[0] = {p.x, -numeric_limits<EVENT_DATA_TYPE>::infinity()};//bottom left
+				verts[1] = {numeric_limits<EVENT_DATA_TYPE>::infinity(), p.y};//top right
 				break;
 			}
 			case Q4:
 			{
-				verts[0] = {-numeric_limits<double>::infinity(), -numeric_limits<double>::infinity()};//bottom left
+				verts[0] = {-numeric_limits<EVENT_DATA_TYPE>::infinity(), -numeric_limits<EVENT_DATA_TYPE>::infinity()};//bottom left
 				verts[1] = {p.x, p.y};//top right
 				break;
 			}
@@ -23,13 +23,15 @@ using namespace std;
 
 namespace cytolib
 {
-	enum class FileFormat {H5, MEM};
+	enum class FileFormat {H5, MEM, MMAP};
 	inline string fmt_to_str(FileFormat fmt)
 	{
 		switch(fmt)
 		{
 		case FileFormat::H5:
 			return "h5";
+		case FileFormat::MMAP:
+			return "mmap";
 		default:
 			return "mem";
 		}
@@ -46,6 +48,21 @@ namespace cytolib
 
 	void PRINT(string a);
 	void PRINT(const char * a);
+	/**
+	 * collect the messages PRINTed by the current thread instead of printing them while it is alive.
+	 * The worker threads use it since PRINT may call the R API, which is only safe from the main thread,
+	 * and the messages are PRINTed later by the calling thread.
+	 */
+	class PrintBuffer{
+		string msg_;
+		string * prev_;
+	public:
+		PrintBuffer();
+		~PrintBuffer();
+		PrintBuffer(const PrintBuffer &) = delete;
+		PrintBuffer & operator=(const PrintBuffer &) = delete;
+		const string & str() const{return msg_;}
+	};
 
 	extern vector<string> spillover_keys;
 	extern unsigned short g_loglevel;// debug print is turned off by default
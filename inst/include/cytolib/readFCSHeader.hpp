@@ -40,31 +40,53 @@ typedef vector<pair <string, string>> KW_PAIR;
 /**
  * this class mimic the map behavior so that the same code
  * can be used for both map and vector based container
+ *
+ * The pairs are kept in insertion order (which is what gets written to FCS/H5)
+ * and a hash index from keyword name to position makes the lookups O(1).
+ * Keys must not be modified through iterators, use rename instead.
+ * The positional accessors (resize, operator[](int)) can change the keys, so they invalidate the index
+ * and it is rebuilt on the next non-const lookup.
  */
 class vec_kw_constainer{
  KW_PAIR kw;
+ unordered_map<string, size_t> idx;//keyword name -> position in kw (the first one when duplicated)
+ bool is_idx_valid = true;
+ void build_index(){
+	 idx.clear();
+	 idx.reserve(kw.size());
+	 for(size_t i = 0; i < kw.size(); i++)
+		 idx.emplace(kw[i].first, i);
+	 is_idx_valid = true;
+ }
 public:
  typedef KW_PAIR::iterator iterator;
  typedef KW_PAIR::const_iterator const_iterator;
- void clear(){kw.clear();}
- void resize(size_t n){kw.resize(n);}
+ void clear(){kw.clear();idx.clear();is_idx_valid = true;}
+ void resize(size_t n){kw.resize(n);is_idx_valid = false;}
  size_t size() const{return kw.size();}
  const KW_PAIR & getPairs() const{return kw;}
- void setPairs(const KW_PAIR & _kw){kw = _kw;}
+ void setPairs(const KW_PAIR & _kw){kw = _kw;build_index();}
  iterator end() {return kw.end();}
  const_iterator end() const{return kw.end();}
  iterator begin(){return kw.begin();}
  const_iterator begin() const{return kw.begin();}
  iterator find(const string &key){
-         return std::find_if(kw.begin(), kw.end(), [key](const pair<string, string> & p){return p.first == key;});
+	 if(!is_idx_valid)
+		 build_index();
+	 auto it = idx.find(key);
+	 return it == idx.end()?kw.end():kw.begin() + it->second;
  }
  const_iterator find(const string &key) const{
-          return std::find_if(kw.begin(), kw.end(), [key](const pair<string, string> & p){return p.first == key;});
+	 if(!is_idx_valid)//can't rebuild the index from const method, fall back to the linear search
+		 return std::find_if(kw.begin(), kw.end(), [&key](const pair<string, string> & p){return p.first == key;});
+	 auto it = idx.find(key);
+	 return it == idx.end()?kw.end():kw.begin() + it->second;
   }
  string & operator [](const string & key){
          iterator it = find(key);
          if(it==end())
          {
+                 idx.emplace(key, kw.size());
                  kw.push_back(pair<string, string>(key, ""));
                  return kw.back().second;
          }
@@ -72,15 +94,40 @@ public:
                  return it->second;
    }
  pair <string, string> & operator [](const int & n){
+	 is_idx_valid = false;
 	 return kw[n];
  }
  void erase(const string & key){
 	 iterator it = find(key);
      if(it!=end())
-     	kw.erase(it);
+     {
+    	kw.erase(it);
+    	build_index();//positions after the erased one are shifted
+     }
      else
      	throw(domain_error("keyword not found: " + key));
  };
+ /**
+  * change the name of the keyword in place
+  */
+ void rename(const string & old_key, const string & new_key){
+	 iterator it = find(old_key);
+	 if(it==end())
+		 throw(domain_error("keyword not found: " + old_key));
+	 size_t pos = it - kw.begin();
+	 it->first = new_key;
+	 idx.erase(old_key);
+	 auto res = idx.emplace(new_key, pos);
+	 if(!res.second && res.first->second > pos)
+		 res.first->second = pos;
+	 //in case of the duplicated keyword names, the next one takes over the old name
+	 for(size_t i = pos + 1; i < kw.size(); i++)
+		 if(kw[i].first == old_key)
+		 {
+			 idx.emplace(old_key, i);
+			 break;
+		 }
+ }
 };
 
 
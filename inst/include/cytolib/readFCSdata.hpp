@@ -20,6 +20,18 @@
 namespace cytolib
 {
 typedef unsigned char BYTE;
+/**
+ * the size (in bytes) of the slice of DATA segment decoded by a thread at a time, which is meant to fit in L2 cache
+ */
+const size_t FCS_DECODE_BLOCK_BYTES = 256 * 1024;
+/**
+ * which_lines rows that are no further apart than this (in bytes) are fetched by a single read
+ */
+const size_t FCS_COALESCE_GAP_BYTES = 64 * 1024;
+/**
+ * the max size (in bytes) of a single coalesced read of which_lines rows
+ */
+const size_t FCS_COALESCE_SPAN_BYTES = 4 * 1024 * 1024;
 
 
 /**
@@ -30,8 +42,11 @@ struct FCS_READ_DATA_PARAM{
 	 EVENT_DATA_TYPE decades, min_limit;
 	 TransformType transform;
 	 int num_threads; //number of cores to be used for parallel-read of data (channel / core)
-	 vector<int64_t> which_lines; //select rows to be read in
+	 vector<int64_t> which_lines; //select rows to be read in. When it has a single value n, n rows are randomly sampled
 	 int seed;
+	 bool sample_without_replacement;//whether the random sampling of which_lines draws distinct rows
+	 vector<string> channels;//only decode these channels (in this order). All channels are read when empty
+	 bool use_mmap;//decode events directly from the memory-mapped DATA segment instead of copying it into a separate buffer first
 	 bool isTransformed;//record the outcome after parsing
 	 FCS_READ_DATA_PARAM(){
 		 scale = false;
@@ -43,6 +58,8 @@ struct FCS_READ_DATA_PARAM{
 		 num_threads = 1;
 		 isTransformed = false;
 		 seed = 1;
+		 sample_without_replacement = false;
+		 use_mmap = false;
 	 }
 
 
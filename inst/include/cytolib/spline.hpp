@@ -12,6 +12,7 @@
 
 #define SPLINE_HPP_
 #include <vector>
+#include <cytolib/datatype.hpp>
 using namespace std;
 
 namespace cytolib
@@ -38,7 +39,7 @@ void spline_eval_C(int *method, int *nu, double *u, double *v,
  */
 
 void natural_spline(vector<double>x, vector<double> y, vector<double>& b,vector<double>& c,vector<double>& d);
-void spline_eval(int method, double* u,int nSize,
+void spline_eval(int method, EVENT_DATA_TYPE* u,int nSize,
 		  const vector<double> & x, const vector<double> & y, const vector<double> & b, const vector<double> & c, const vector<double> & d);
 };
 #endif /* SPLINE_HPP_ */
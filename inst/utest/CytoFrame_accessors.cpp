@@ -2,7 +2,15 @@
 #include <cytolib/GatingSet.hpp>
 #include <cytolib/TileCytoFrame.hpp>
 #include <cytolib/H5CytoFrame.hpp>
+#include <cytolib/H5ContainerCytoFrame.hpp>
+#include <cytolib/MappedCytoFrame.hpp>
+#include <cytolib/SharedCytoFrame.hpp>
 #include <cytolib/MemCytoFrame.hpp>
+#ifndef _WIN32
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "fixture.hpp"
 using namespace cytolib;
@@ -255,6 +263,319 @@ BOOST_AUTO_TEST_CASE(h5_vs_mem)
 	BOOST_CHECK_EQUAL(fr.get_params().begin()->max, cf_disk->get_params().begin()->max);
 
 }
+BOOST_AUTO_TEST_CASE(h5_streaming_convert)
+{
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	//a budget of a few KB forces the conversion into many blocks
+	H5CytoFrame fr1(file_path, config, h5file, true, 4096);
+	BOOST_CHECK_EQUAL(fr1.n_rows(), fr.n_rows());
+	auto params = fr.get_params();
+	auto params1 = fr1.get_params();
+	for(unsigned i = 0; i < params.size(); i++)
+	{
+		BOOST_CHECK_EQUAL(params[i].channel, params1[i].channel);
+		BOOST_CHECK_CLOSE(params[i].min, params1[i].min, 1e-6);
+		BOOST_CHECK_CLOSE(params[i].max, params1[i].max, 1e-6);
+	}
+	BOOST_CHECK_EQUAL(fr.get_keyword("transformation"), fr1.get_keyword("transformation"));
+	EVENT_DATA_VEC dat = fr.get_data();
+	EVENT_DATA_VEC dat1 = fr1.get_data();
+	BOOST_CHECK_CLOSE(dat[1], dat1[1], 1e-4);
+	BOOST_CHECK_CLOSE(dat[dat.n_elem - 1], dat1[dat1.n_elem - 1], 1e-4);
+	BOOST_CHECK_CLOSE(arma::accu(dat), arma::accu(dat1), 1e-4);
+}
+BOOST_AUTO_TEST_CASE(h5_handle_cache)
+{
+	auto & cache = H5FileCache::instance();
+	auto capacity = cache.get_capacity();
+	cache.clear();
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr.write_h5(h5file);
+	H5CytoFrame fr1(h5file, true);
+	EVENT_DATA_VEC dat = fr1.get_data();
+	//repeated reads reuse the same handle
+	BOOST_CHECK_EQUAL(cache.size(), 1);
+	BOOST_CHECK(cache.open(h5file, H5F_ACC_RDONLY) == cache.open(h5file, H5F_ACC_RDONLY));
+
+	//switch to write mode reopens it
+	fr1.set_readonly(false);
+	BOOST_CHECK_EQUAL(cache.size(), 0);
+	dat[100] = 100;
+	fr1.set_data(dat);
+	fr1.set_readonly(true);
+	BOOST_CHECK_CLOSE(fr1.get_data()[100], 100, 1e-6);
+	H5CytoFrame fr2(h5file, false);
+	BOOST_CHECK_CLOSE(fr2.get_data()[100], 100, 1e-6);
+
+	//overwriting the file drops the stale handle
+	fr.write_h5(h5file);
+	H5CytoFrame fr3(h5file, true);
+	BOOST_CHECK_CLOSE(fr3.get_data()[100], fr.get_data()[100], 1e-6);
+
+	//the least recently used file is closed when the capacity is reached
+	cache.set_capacity(1);
+	auto cp = fr3.copy();
+	cp->get_data();
+	BOOST_CHECK_EQUAL(cache.size(), 1);
+	BOOST_CHECK_CLOSE(fr3.get_data()[100], fr.get_data()[100], 1e-6);
+	cache.set_capacity(0);
+	BOOST_CHECK_EQUAL(cache.size(), 0);
+	BOOST_CHECK_CLOSE(fr3.get_data()[100], fr.get_data()[100], 1e-6);
+	cache.set_capacity(capacity);
+}
+BOOST_AUTO_TEST_CASE(h5_handle_cache_sharing)
+{
+	auto & cache = H5FileCache::instance();
+	cache.clear();
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	string h5file_new = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr.write_h5(h5file);
+	H5CytoFrame fr1(h5file, true);
+	EVENT_DATA_VEC dat = fr1.get_data();
+	BOOST_CHECK_EQUAL(cache.size(), 1);
+#ifndef _WIN32
+	//the writer of the other process can't lock the file until it is closed here
+	auto can_lock = [&](){
+		int fd = ::open(h5file.c_str(), O_RDWR);
+		bool res = flock(fd, LOCK_EX | LOCK_NB) == 0;
+		::close(fd);
+		return res;
+	};
+	const char * locking = getenv("HDF5_USE_FILE_LOCKING");
+	if(!locking || string(locking) != "FALSE")
+		BOOST_CHECK(!can_lock());
+	cache.evict(h5file);
+	BOOST_CHECK(can_lock());
+	fr1.get_data();
+#endif
+
+	//the file replaced by the other process is reopened instead of serving the stale one
+	MemCytoFrame fr_new(fr);
+	dat[100] = 100;
+	fr_new.set_data(dat);
+	fr_new.write_h5(h5file_new);
+	fs::rename(h5file_new, h5file);
+	BOOST_CHECK_CLOSE(fr1.get_data()[100], 100, 1e-6);
+
+	//the conflicting flags fail while the handle is in use, without dropping the other cached files
+	{
+		auto h5 = cache.open(h5file, H5F_ACC_RDONLY);
+		BOOST_CHECK_THROW(H5CytoFrame(h5file, false), domain_error);
+		BOOST_CHECK_EQUAL(cache.size(), 1);
+	}
+	H5CytoFrame fr2(h5file, false);
+	BOOST_CHECK_CLOSE(fr2.get_data()[100], 100, 1e-6);
+	cache.clear();
+	fs::remove(h5file);
+}
+BOOST_AUTO_TEST_CASE(h5_read_columns)
+{
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr.write_h5(h5file);
+	H5CytoFrame fr1(h5file, true);
+	EVENT_DATA_VEC dat = fr.get_data();
+	//contiguous, gapped, unsorted and duplicated columns
+	vector<uvec> col_idx = {{0, 1, 2, 3}, {0, 2, 3, 6}, {5, 1, 3}, {2, 2, 0}};
+	for(const auto & idx : col_idx)
+	{
+		EVENT_DATA_VEC dat1 = fr1.get_data(idx, true);
+		BOOST_CHECK_EQUAL(dat1.n_cols, idx.size());
+		for(unsigned i = 0; i < idx.size(); i++)
+			BOOST_CHECK_CLOSE(arma::accu(dat1.col(i)), arma::accu(dat.col(idx[i])), 1e-4);
+	}
+	BOOST_CHECK_CLOSE(arma::accu(fr1.get_data()), arma::accu(dat), 1e-4);
+}
+BOOST_AUTO_TEST_CASE(h5_read_rows)
+{
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr.write_h5(h5file);
+	H5CytoFrame fr1(h5file, true);
+	EVENT_DATA_VEC dat = fr.get_data();
+	unsigned nrow = fr.n_rows();
+	//dense, sparse, unsorted and duplicated rows
+	vector<uvec> row_idx = {{0, 1, 2, 3}, {0, 10, 20, nrow - 1}, {nrow / 2, 5, 5, 0}, {}};
+	uvec col_idx = {4, 1};
+	for(const auto & idx : row_idx)
+	{
+		EVENT_DATA_VEC dat1 = fr1.get_data(idx, false);
+		BOOST_CHECK_EQUAL(dat1.n_rows, idx.size());
+		BOOST_CHECK_EQUAL(dat1.n_cols, dat.n_cols);
+		BOOST_CHECK(arma::approx_equal(dat1, EVENT_DATA_VEC(dat.rows(idx)), "reldiff", 1e-6));
+		dat1 = fr1.get_data(idx, col_idx);
+		BOOST_CHECK(arma::approx_equal(dat1, EVENT_DATA_VEC(dat.submat(idx, col_idx)), "reldiff", 1e-6));
+	}
+	BOOST_CHECK_THROW(fr1.get_data(uvec({nrow}), false), domain_error);
+	//row-indexed view reads through the same path
+	CytoFrameView cv(CytoFramePtr(new H5CytoFrame(fr1)));
+	cv.rows_(uvec({3, 1, 2}));
+	BOOST_CHECK(arma::approx_equal(cv.get_data(), EVENT_DATA_VEC(dat.rows(uvec({3, 1, 2}))), "reldiff", 1e-6));
+}
+BOOST_AUTO_TEST_CASE(h5_read_scattered_rows)
+{
+	//enough rows for the scattered ones to exceed H5_MAX_SELECTION_BLOCKS, each row is tagged by its index
+	EVENT_DATA_VEC dat = arma::repmat(fr.get_data(), 200000 / fr.n_rows() + 1, 1);
+	unsigned nrow = dat.n_rows;
+	dat.col(0) = arma::linspace<arma::Col<EVENT_DATA_TYPE>>(0, nrow - 1, nrow);
+	MemCytoFrame fr0(fr);
+	fr0.del_rownames();
+	fr0.set_data(dat);
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr0.write_h5(h5file);
+	H5CytoFrame fr1(h5file, true);
+
+	//5 of every 70 rows are dense enough to be read as the entire span
+	vector<unsigned> clustered;
+	for(unsigned i = 0; i + 5 <= nrow; i += 70)
+		for(unsigned j = 0; j < 5; j++)
+			clustered.push_back(i + j);
+	//1 of every 150 rows is read as points, shuffled and with a duplicate
+	uvec sparse = arma::shuffle(arma::regspace<uvec>(3, 150, nrow - 1));
+	sparse = arma::join_cols(sparse, uvec({sparse[0]}));
+	uvec col_idx = {4, 0, 2};
+	for(const auto & idx : {arma::conv_to<uvec>::from(clustered), sparse})
+	{
+		BOOST_CHECK_GT(idx.n_elem, H5_MAX_SELECTION_BLOCKS);
+		BOOST_CHECK(arma::approx_equal(fr1.get_data(idx, false), EVENT_DATA_VEC(dat.rows(idx)), "reldiff", 1e-6));
+		BOOST_CHECK(arma::approx_equal(fr1.get_data(idx, col_idx), EVENT_DATA_VEC(dat.submat(idx, col_idx)), "reldiff", 1e-6));
+	}
+	H5FileCache::instance().evict(h5file);
+	fs::remove(h5file);
+}
+BOOST_AUTO_TEST_CASE(h5_compression)
+{
+	//compare size and read throughput of the events layouts
+	EVENT_DATA_VEC dat = fr.get_data();
+	vector<pair<string, H5_WRITE_PARAM>> layouts(4);
+	layouts[0].first = "default";
+	layouts[1].first = "chunked";
+	layouts[1].second.events_per_chunk = 4096;
+	layouts[2].first = "deflate";
+	layouts[2].second.events_per_chunk = 4096;
+	layouts[2].second.compression = H5Compression::deflate;
+	layouts[2].second.compression_level = 4;
+	layouts[3].first = "shuffle+deflate";
+	layouts[3].second = layouts[2].second;
+	layouts[3].second.shuffle = true;
+	for(const auto & it : layouts)
+	{
+		string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+		CytoCtx ctx;
+		ctx.set_h5_write_param(it.second);
+		fr.write_to_disk(h5file, FileFormat::H5, ctx);
+		H5CytoFrame fr1(h5file, true);
+		double start = gettime();
+		EVENT_DATA_VEC dat1 = fr1.get_data();
+		double runtime = (gettime() - start);
+		cout << it.first << ": " << fs::file_size(h5file) << " bytes, get_data(): " << runtime << endl;
+		BOOST_CHECK(arma::approx_equal(dat1, dat, "reldiff", 1e-6));
+		//the layout is kept by the copies
+		string copy_file = fr1.copy(uvec({0, 1}), false)->get_uri();
+		auto param = H5CytoFrame(copy_file, true).get_h5_write_param();
+		BOOST_CHECK(param.compression == it.second.compression);
+		BOOST_CHECK_EQUAL(param.shuffle, it.second.shuffle);
+		for(const auto & f : {h5file, copy_file})
+		{
+			H5FileCache::instance().evict(f);
+			fs::remove(f);
+		}
+	}
+}
+BOOST_AUTO_TEST_CASE(h5_chunk_cache)
+{
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	H5_WRITE_PARAM write_param;
+	write_param.events_per_chunk = 1024;
+	write_param.compression = H5Compression::deflate;
+	fr.write_h5(h5file, write_param);
+	EVENT_DATA_VEC dat = fr.get_data();
+
+	auto & cache = H5FileCache::instance();
+	auto default_param = cache.get_default_cache_param();
+	H5_CACHE_PARAM param;
+	param.rdcc_nbytes = 64 * 1024 * 1024;
+	param.rdcc_nslots = 10007;
+	param.read_ahead = H5ReadAhead::sequential;
+	cache.set_default_cache_param(param);
+	H5CytoFrame fr1(h5file, true);
+	cache.set_default_cache_param(default_param);
+	BOOST_CHECK(fr1.get_h5_cache_param() == param);
+	//the chunk cache of the events dataset that the frame reads through
+	auto check_chunk_cache = [&](const H5_CACHE_PARAM & p){
+		auto h5 = cache.open(h5file, H5F_ACC_RDONLY, FileAccPropList::DEFAULT, p);
+		hid_t dapl = H5Dget_access_plist(h5->dataset(DATASET_NAME).getId());
+		size_t nslots, nbytes;
+		double w0;
+		H5Pget_chunk_cache(dapl, &nslots, &nbytes, &w0);
+		H5Pclose(dapl);
+		BOOST_CHECK_EQUAL(nbytes, p.rdcc_nbytes);
+		if(p.rdcc_nbytes > 0)//h5 reports no slots for the disabled cache
+			BOOST_CHECK_EQUAL(nslots, p.rdcc_nslots);
+	};
+	BOOST_CHECK(arma::approx_equal(fr1.get_data(uvec({0, 1}), true), EVENT_DATA_VEC(dat.cols(uvec({0, 1}))), "reldiff", 1e-6));
+	check_chunk_cache(param);
+	//per-frame setting
+	param.rdcc_nbytes = 0;//disable the cache
+	param.read_ahead = H5ReadAhead::prefetch;
+	fr1.set_h5_cache_param(param);
+	BOOST_CHECK(arma::approx_equal(fr1.get_data(), dat, "reldiff", 1e-6));
+	check_chunk_cache(param);
+	BOOST_CHECK(H5CytoFrame(fr1).get_h5_cache_param() == param);
+	cache.evict(h5file);
+	fs::remove(h5file);
+}
+BOOST_AUTO_TEST_CASE(h5_direct_chunk_read)
+{
+	EVENT_DATA_VEC dat = fr.get_data();
+	H5_CACHE_PARAM param;
+	BOOST_CHECK(!param.direct_chunk_read);
+	param.direct_chunk_read = true;
+	//one chunk per channel, the partial last chunk of events and several channels per chunk
+	vector<H5_WRITE_PARAM> layouts(3);
+	layouts[1].events_per_chunk = 1000;
+	layouts[2].events_per_chunk = 1000;
+	layouts[2].channels_per_chunk = 3;
+	//unsorted and duplicated columns
+	uvec cols = {4, 0, 4, 1};
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	for(const auto & write_param : layouts)
+	{
+		fr.write_h5(h5file, write_param);
+		H5CytoFrame fr1(h5file, true);
+		fr1.set_h5_cache_param(param);
+		BOOST_CHECK(arma::approx_equal(fr1.get_data(), dat, "reldiff", 1e-6));
+		BOOST_CHECK(arma::approx_equal(fr1.get_data(cols, true), EVENT_DATA_VEC(dat.cols(cols)), "reldiff", 1e-6));
+	}
+
+	//filtered chunks fall back to the regular read
+	H5_WRITE_PARAM write_param;
+	write_param.compression = H5Compression::deflate;
+	fr.write_h5(h5file, write_param);
+	{
+		H5CytoFrame fr1(h5file, true);
+		fr1.set_h5_cache_param(param);
+		BOOST_CHECK(arma::approx_equal(fr1.get_data(), dat, "reldiff", 1e-6));
+	}
+	H5FileCache::instance().evict(h5file);
+	fs::remove(h5file);
+}
+BOOST_AUTO_TEST_CASE(keywords)
+{
+	MemCytoFrame fr1(fr);
+	auto nKey = fr1.get_keywords().size();
+	string first_key = fr1.get_keywords().begin()->first;
+	string val = fr1.get_keyword("$P3N");
+
+	fr1.rename_keyword("$P3N", "new_key");
+	BOOST_CHECK_EQUAL(fr1.get_keyword("$P3N"), "");
+	BOOST_CHECK_EQUAL(fr1.get_keyword("new_key"), val);
+	fr1.remove_keyword(first_key);
+	BOOST_CHECK_EQUAL(fr1.get_keywords().size(), nKey - 1);
+	//lookups still land on the right pairs after the positions shift
+	BOOST_CHECK_EQUAL(fr1.get_keyword("new_key"), val);
+	fr1.set_keyword(first_key, "v");
+	BOOST_CHECK_EQUAL((fr1.get_keywords().end() - 1)->first, first_key);
+	BOOST_CHECK_EQUAL(fr1.get_keyword(first_key), "v");
+}
 BOOST_AUTO_TEST_CASE(flags)
 {
 	if(file_format == FileFormat::H5)
@@ -383,6 +704,129 @@ BOOST_AUTO_TEST_CASE(rownames)
 	BOOST_CHECK_EQUAL(cf2.get_rownames()[1], rn[1]);
 
 }
+BOOST_AUTO_TEST_CASE(compact_rownames)
+{
+	BOOST_CHECK(RowNames({"1", "2", "3"}).get_encoding() == RowNames::Encoding::counter);
+	BOOST_CHECK(RowNames({"cell_5", "cell_9", "cell_2"}).get_encoding() == RowNames::Encoding::ids);
+	BOOST_CHECK(RowNames({"a", "b01", "b1"}).get_encoding() == RowNames::Encoding::pool);
+	BOOST_CHECK(RowNames({"1", "01"}).get_encoding() == RowNames::Encoding::pool);//not canonical integer
+
+	unsigned nrow = fr.n_rows();
+	MemCytoFrame fr0(fr);
+	fr0.set_compact_rownames(RowNames::counter(nrow, 0, "cell_"));
+	BOOST_CHECK_THROW(fr0.set_compact_rownames(RowNames::counter(nrow + 1)), domain_error);
+	auto rn = fr0.get_rownames();
+	BOOST_CHECK_EQUAL(rn.size(), nrow);
+	BOOST_CHECK_EQUAL(rn[nrow - 1], "cell_" + to_string(nrow - 1));
+	BOOST_CHECK(RowNames(rn) == fr0.get_compact_rownames());
+
+	//the view shares the names of the frame
+	CytoFrameView cr_new(CytoFramePtr(new MemCytoFrame(fr0)));
+	cr_new.rows_(vector<unsigned>({1, 3, 7}));
+	auto rn_view = cr_new.get_compact_rownames();
+	BOOST_CHECK(rn_view.is_indexed());
+	BOOST_CHECK_EQUAL(rn_view.size(), 3);
+	BOOST_CHECK_EQUAL(rn_view[2], "cell_7");
+	BOOST_CHECK_EQUAL(cr_new.copy_realized().get_rownames()[1], "cell_3");
+
+	//h5
+	StrType str_type(H5::PredType::C_S1, H5T_VARIABLE);
+	//the legacy strings as they are read by the earlier versions
+	auto read_legacy = [&](const string & filename){
+		H5FileCache::instance().evict(filename);
+		H5File file(filename, H5F_ACC_RDONLY);
+		DataSet ds = file.openDataSet(DATASET_ROWNAME);
+		hsize_t dims[1];
+		ds.getSpace().getSimpleExtentDims(dims);
+		vector<char *> rn_c_str(dims[0]);
+		ds.read(rn_c_str.data(), str_type);
+		vector<string> res(rn_c_str.begin(), rn_c_str.end());
+		DataSet::vlenReclaim(rn_c_str.data(), str_type, ds.getSpace());
+		return res;
+	};
+	auto write_legacy = [&](const string & filename, unsigned n, const char * name){
+		H5FileCache::instance().evict(filename);
+		H5File file(filename, H5F_ACC_RDWR);
+		if(file.exists(DATASET_ROWNAME))
+			file.unlink(DATASET_ROWNAME);
+		hsize_t dims[1] = {n};
+		DataSet ds = file.createDataSet(DATASET_ROWNAME, str_type, DataSpace(1, dims));
+		vector<const char *> rn_c_str(n, name);
+		ds.write(rn_c_str.data(), str_type);
+	};
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr0.write_h5(h5file);
+	{
+		H5File file(h5file, H5F_ACC_RDONLY);
+		BOOST_CHECK(file.exists(DATASET_ROWNAME_COUNTER));
+		BOOST_CHECK(file.exists(DATASET_ROWNAME));
+	}
+	BOOST_CHECK(read_legacy(h5file) == fr0.get_rownames());
+	{
+		H5CytoFrame fr1(h5file, false);
+		BOOST_CHECK(fr1.get_compact_rownames() == fr0.get_compact_rownames());
+		//appending the names of the other prefix switches to the pool
+		EVENT_DATA_VEC new_rows = fr.get_data().rows(0, 1);
+		fr1.append_rows(new_rows, {"x", "y"});
+		auto rn1 = fr1.get_compact_rownames();
+		BOOST_CHECK(rn1.get_encoding() == RowNames::Encoding::pool);
+		BOOST_CHECK_EQUAL(rn1.size(), nrow + 2);
+		BOOST_CHECK_EQUAL(rn1[0], "cell_0");
+		BOOST_CHECK_EQUAL(rn1[nrow + 1], "y");
+		//the legacy strings are extended as well
+		BOOST_CHECK(read_legacy(h5file) == rn1.to_vector());
+		//the legacy strings extended by the earlier versions outnumber the compact names
+		write_legacy(h5file, nrow + 3, "z");
+		BOOST_CHECK_EQUAL(fr1.get_rownames().size(), nrow + 3);
+		fr1.del_rownames();
+		BOOST_CHECK_EQUAL(fr1.get_rownames().size(), 0);
+	}
+
+	//only the compact names when opted out
+	H5_WRITE_PARAM param;
+	param.legacy_rownames = false;
+	fr0.write_h5(h5file, param);
+	{
+		H5CytoFrame fr3(h5file, false);
+		BOOST_CHECK(!fr3.get_h5_write_param().legacy_rownames);
+		fr3.set_rownames(vector<string>(nrow, "a"));
+		H5FileCache::instance().evict(h5file);
+		H5File file(h5file, H5F_ACC_RDONLY);
+		BOOST_CHECK(file.exists(DATASET_ROWNAME_POOL));
+		BOOST_CHECK(!file.exists(DATASET_ROWNAME));
+	}
+
+	//the variable-length strings written by the earlier versions
+	string h5file_legacy = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr.write_h5(h5file_legacy);
+	{
+		H5File file(h5file_legacy, H5F_ACC_RDWR);
+		RowNames::remove_h5(file);
+	}
+	write_legacy(h5file_legacy, nrow, "z");
+	{
+		H5CytoFrame fr2(h5file_legacy, false);
+		auto rn2 = fr2.get_compact_rownames();
+		BOOST_CHECK_EQUAL(rn2.size(), nrow);
+		BOOST_CHECK_EQUAL(rn2[nrow - 1], "z");
+		BOOST_CHECK(fr2.get_h5_write_param().legacy_rownames);
+		//they are extended in their format without adding the compact names
+		fr2.append_rows(fr.get_data().rows(0, 0), {"w"});
+		auto rn = read_legacy(h5file_legacy);
+		BOOST_CHECK_EQUAL(rn.size(), nrow + 1);
+		BOOST_CHECK_EQUAL(rn[nrow], "w");
+		H5FileCache::instance().evict(h5file_legacy);
+		H5File file(h5file_legacy, H5F_ACC_RDONLY);
+		BOOST_CHECK(!file.exists(DATASET_ROWNAME_COUNTER));
+		BOOST_CHECK(!file.exists(DATASET_ROWNAME_IDS));
+		BOOST_CHECK(!file.exists(DATASET_ROWNAME_POOL));
+	}
+	for(auto f : {h5file, h5file_legacy})
+	{
+		H5FileCache::instance().evict(f);
+		fs::remove(f);
+	}
+}
 BOOST_AUTO_TEST_CASE(subset_by_rows)
 {
 	unsigned nEvent = fr.n_rows();
@@ -517,6 +961,329 @@ BOOST_AUTO_TEST_CASE(append_columns)
   BOOST_CHECK_EQUAL(fr1.get_keyword("$P" + to_string(fr1.n_cols()) + "G"), "");
   BOOST_CHECK_EQUAL(fr1.get_keyword("$P" + to_string(fr1.n_cols()-1) + "R"), to_string(new_params[fr1.n_cols()-2].max + 1));
 }
+BOOST_AUTO_TEST_CASE(h5_append_columns)
+{
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr.write_h5(h5file);
+	H5CytoFrame fr1(h5file, false);
+	unsigned ncol = fr1.n_cols();
+	EVENT_DATA_VEC dat = fr.get_data();
+	EVENT_DATA_VEC new_cols = dat.cols(uvec({6, 7}));
+	fr1.append_columns({"new_channel_1", "new_channel_2"}, new_cols);
+	BOOST_CHECK_EQUAL(fr1.n_cols(), ncol + 2);
+	BOOST_CHECK_EQUAL(fr1.n_rows(), fr.n_rows());
+	//the existing columns are intact
+	BOOST_CHECK(arma::approx_equal(fr1.get_data(arma::regspace<uvec>(0, ncol - 1), true), dat, "reldiff", 1e-6));
+	BOOST_CHECK(arma::approx_equal(fr1.get_data(uvec({ncol, ncol + 1}), true), new_cols, "reldiff", 1e-6));
+
+	//reload from disk
+	H5CytoFrame fr2(h5file, true);
+	BOOST_CHECK_EQUAL(fr2.n_cols(), ncol + 2);
+	BOOST_CHECK_EQUAL(fr2.get_channels()[ncol + 1], "new_channel_2");
+	BOOST_CHECK_EQUAL(fr2.get_keyword("$P" + to_string(ncol + 1) + "N"), "new_channel_1");
+	BOOST_CHECK(arma::approx_equal(fr2.get_data(uvec({ncol + 1}), true), EVENT_DATA_VEC(new_cols.col(1)), "reldiff", 1e-6));
+}
+
+BOOST_AUTO_TEST_CASE(h5_append_rows)
+{
+	EVENT_DATA_VEC dat = fr.get_data();
+	unsigned nrow = fr.n_rows();
+	EVENT_DATA_VEC new_rows = dat.rows(0, 9);
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	MemCytoFrame fr0(fr);
+	vector<string> rn(nrow);
+	for(unsigned i = 0; i < nrow; i++)
+		rn[i] = "r" + to_string(i);
+	fr0.set_rownames(rn);
+	fr0.write_h5(h5file);
+
+	H5CytoFrame fr1(h5file, false);
+	BOOST_CHECK_THROW(fr1.append_rows(new_rows), domain_error);//rownames are missing
+	BOOST_CHECK_THROW(fr1.append_rows(new_rows.cols(0, 1), vector<string>(10, "x")), domain_error);
+	vector<string> new_rn(10);
+	for(unsigned i = 0; i < 10; i++)
+		new_rn[i] = "new" + to_string(i);
+	fr1.append_rows(new_rows, new_rn);
+	BOOST_CHECK_EQUAL(fr1.n_rows(), nrow + 10);
+	BOOST_CHECK(arma::approx_equal(fr1.get_data(), EVENT_DATA_VEC(arma::join_cols(dat, new_rows)), "reldiff", 1e-6));
+
+	H5CytoFrame fr2(h5file, true);
+	BOOST_CHECK_EQUAL(fr2.n_rows(), nrow + 10);
+	auto rn2 = fr2.get_rownames();
+	BOOST_CHECK_EQUAL(rn2.size(), nrow + 10);
+	BOOST_CHECK_EQUAL(rn2[nrow - 1], rn[nrow - 1]);
+	BOOST_CHECK_EQUAL(rn2[nrow + 9], "new9");
+
+	//SWMR
+	H5_WRITE_PARAM param;
+	param.swmr = true;
+	fr.write_h5(h5file, param);
+	H5CytoFrame writer(h5file, false);
+	writer.set_swmr(true);
+	H5CytoFrame reader(h5file, true);
+	reader.set_swmr(true);
+	writer.append_rows(new_rows);
+	BOOST_CHECK_EQUAL(reader.n_rows(), nrow);
+	reader.refresh();
+	BOOST_CHECK_EQUAL(reader.n_rows(), nrow + 10);
+	BOOST_CHECK(arma::approx_equal(reader.get_data(arma::regspace<uvec>(nrow, nrow + 9), false), new_rows, "reldiff", 1e-6));
+}
+
+BOOST_AUTO_TEST_CASE(set_data_cols)
+{
+	EVENT_DATA_VEC dat = fr.get_data();
+	EVENT_DATA_VEC new_cols = dat.cols(uvec({2, 0})) * 2;
+	//mem
+	MemCytoFrame fr1(fr);
+	fr1.set_data(new_cols, uvec({5, 1}));
+	EVENT_DATA_VEC expect = dat;
+	expect.cols(uvec({5, 1})) = new_cols;
+	BOOST_CHECK(arma::approx_equal(fr1.get_data(), expect, "absdiff", 0));
+	BOOST_CHECK_THROW(fr1.set_data(new_cols, uvec({1, 1})), domain_error);
+	BOOST_CHECK_THROW(fr1.set_data(new_cols, uvec({1})), domain_error);
+
+	//h5 with unsorted and non-contiguous columns
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr.write_h5(h5file);
+	H5CytoFrame fr2(h5file, false);
+	EVENT_DATA_VEC dat2 = fr2.get_data();
+	expect = dat2;
+	new_cols = dat2.cols(uvec({2, 0, 3})) * 2;
+	expect.cols(uvec({5, 1, 2})) = new_cols;
+	fr2.set_data(new_cols, uvec({5, 1, 2}));
+	BOOST_CHECK(arma::approx_equal(H5CytoFrame(h5file, true).get_data(), expect, "reldiff", 1e-6));
+
+	//view with both rows and cols subsetted
+	CytoFrameView cv(CytoFramePtr(new MemCytoFrame(fr)));
+	cv.cols_(uvec({1, 3, 5}));
+	cv.rows_(uvec({3, 1, 2}));
+	new_cols = EVENT_DATA_VEC(3, 1, arma::fill::zeros);
+	cv.set_data(new_cols, uvec({1}));
+	expect = dat;
+	expect.submat(uvec({3, 1, 2}), uvec({3})).zeros();
+	BOOST_CHECK(arma::approx_equal(cv.get_cytoframe_ptr()->get_data(), expect, "absdiff", 0));
+}
+
+BOOST_AUTO_TEST_CASE(h5_container)
+{
+	EVENT_DATA_VEC dat = fr.get_data();
+	string dir = generate_unique_dir(fs::temp_directory_path().string(), "h5c");
+	string container = (fs::path(dir) / H5_CONTAINER_FILENAME).string();
+	string uri1 = h5_container_uri(container, "s1");
+	string uri2 = h5_container_uri(container, "s2");
+	string c, sn;
+	BOOST_CHECK(parse_h5_container_uri(uri1, c, sn));
+	BOOST_CHECK_EQUAL(c, container);
+	BOOST_CHECK_EQUAL(sn, "s1");
+	BOOST_CHECK(!is_h5_container_uri(container));
+
+	write_h5_container(fr, uri1);
+	write_h5_container(*fr.copy(arma::regspace<uvec>(0, 9), true), uri2);
+	auto samples = list_h5_container(container);
+	sort(samples.begin(), samples.end());
+	vector<string> expect = {"s1", "s2"};
+	BOOST_CHECK_EQUAL_COLLECTIONS(samples.begin(), samples.end(), expect.begin(), expect.end());
+	BOOST_CHECK(has_h5_container_sample(container, "s2"));
+	BOOST_CHECK(!has_h5_container_sample(container, "s3"));
+
+	auto fr1 = load_cytoframe(uri1, false);
+	BOOST_CHECK_EQUAL(fr1->get_uri(), uri1);
+	BOOST_CHECK(arma::approx_equal(fr1->get_data(), dat, "reldiff", 1e-6));
+	BOOST_CHECK_EQUAL(load_cytoframe(uri2)->n_rows(), 10);
+	BOOST_CHECK_THROW(load_cytoframe(h5_container_uri(container, "s3")), domain_error);
+
+	//update the meta data of one sample
+	string oldname = fr1->get_channels()[2];
+	fr1->set_channel(oldname, "new");
+	fr1->flush_meta();
+	BOOST_CHECK_EQUAL(load_cytoframe(uri1)->get_channels()[2], "new");
+	BOOST_CHECK_EQUAL(load_cytoframe(uri2)->get_channels()[2], oldname);
+
+	//copy to the regular h5 and to another sample
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr1->copy(h5file);
+	BOOST_CHECK(arma::approx_equal(H5CytoFrame(h5file).get_data(), dat, "reldiff", 1e-6));
+	fr1->copy(uri2, true);
+	BOOST_CHECK_EQUAL(load_cytoframe(uri2)->n_rows(), fr.n_rows());
+	BOOST_CHECK_THROW(fr1->copy(uri1), domain_error);
+
+	remove_h5_container_sample(uri2);
+	BOOST_CHECK_EQUAL(list_h5_container(container).size(), 1);
+	fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(h5_lazy_load)
+{
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	fr.write_h5(h5file);
+
+	CytoCtx ctx;
+	ctx.set_h5_lazy_load(true);
+	auto ptr = load_cytoframe(h5file, true, ctx);
+	auto & fr1 = dynamic_cast<H5CytoFrame &>(*ptr);
+	BOOST_CHECK(!fr1.is_loaded());
+	BOOST_CHECK_EQUAL(fr1.get_uri(), h5file);
+	BOOST_CHECK_EQUAL(fr1.n_rows(), fr.n_rows());
+	BOOST_CHECK(fr1.is_loaded());
+	auto ch1 = fr1.get_channels();
+	auto ch = fr.get_channels();
+	BOOST_CHECK_EQUAL_COLLECTIONS(ch1.begin(), ch1.end(), ch.begin(), ch.end());
+
+	//the meta data are loaded before they are copied or modified
+	H5CytoFrame fr2(h5file, false, false);
+	MemCytoFrame fr3(fr2);
+	BOOST_CHECK_EQUAL(fr3.get_keywords().size(), fr.get_keywords().size());
+	BOOST_CHECK(arma::approx_equal(fr3.get_data(), fr.get_data(), "reldiff", 1e-6));
+	H5CytoFrame fr4(h5file, false, false);
+	fr4.set_keyword("lazy", "1");
+	fr4.flush_meta();
+	H5CytoFrame fr5(h5file);
+	BOOST_CHECK_EQUAL(fr5.get_keyword("lazy"), "1");
+	BOOST_CHECK_EQUAL(fr5.get_keywords().size(), fr.get_keywords().size() + 1);
+
+	//missing file is reported on the first access
+	H5CytoFrame fr6(h5file + ".missing", true, false);
+	BOOST_CHECK_THROW(fr6.n_cols(), H5::Exception);
+	BOOST_CHECK(!fr6.is_loaded());
+}
+
+BOOST_AUTO_TEST_CASE(mmap)
+{
+	string dir = generate_unique_dir(fs::temp_directory_path().string(), "mmap");
+	string mmapfile = (fs::path(dir) / ("fr" + MMAP_EXT)).string();
+	fr.write_to_disk(mmapfile, FileFormat::MMAP);
+	EVENT_DATA_VEC dat = fr.get_data();
+	auto ptr = load_cytoframe(mmapfile);
+	BOOST_CHECK(ptr->get_backend_type() == FileFormat::MMAP);
+	auto & fr1 = dynamic_cast<MappedCytoFrame &>(*ptr);
+	BOOST_CHECK(fr1.is_mapped());
+	BOOST_CHECK(arma::approx_equal(fr1.get_data(), dat, "absdiff", 0));
+	auto ch1 = fr1.get_channels();
+	auto ch = fr.get_channels();
+	BOOST_CHECK_EQUAL_COLLECTIONS(ch1.begin(), ch1.end(), ch.begin(), ch.end());
+	BOOST_CHECK_EQUAL(fr1.get_keywords().size(), fr.get_keywords().size());
+	//the columns are served from the mapped pages
+	BOOST_CHECK_EQUAL(fr1.get_data_memptr(ch[1], ColType::channel), fr1.get_data_ref().colptr(1));
+	BOOST_CHECK_EQUAL(fr1.get_data_memptr(ch[1], ColType::channel)[10], dat(10, 1));
+	//the copies share the mapping
+	MappedCytoFrame fr2(fr1);
+	BOOST_CHECK_EQUAL(fr2.get_data_ref().memptr(), fr1.get_data_ref().memptr());
+	//the sidecar is a regular h5 cytoframe
+	BOOST_CHECK(arma::approx_equal(H5CytoFrame(mmap_meta_path(mmapfile)).get_data(), dat, "absdiff", 0));
+
+	BOOST_CHECK_THROW(fr1.set_data(dat), domain_error);
+	MappedCytoFrame fr3(mmapfile, false);
+	EVENT_DATA_VEC col0(dat.n_rows, 1, arma::fill::ones);
+	fr3.set_data(col0, uvec({0}));
+	BOOST_CHECK(fr3.is_mapped());
+	BOOST_CHECK_EQUAL(MappedCytoFrame(mmapfile).get_data()(5, 0), 1);
+	//the frames mapping the old events are not affected
+	BOOST_CHECK_EQUAL(fr1.get_data()(5, 0), dat(5, 0));
+	fr3.append_columns({"new"}, col0);
+	fr3.set_keyword("k1", "v1");
+	fr3.flush_meta();
+	MappedCytoFrame fr4(mmapfile);
+	BOOST_CHECK_EQUAL(fr4.n_cols(), fr.n_cols() + 1);
+	BOOST_CHECK_EQUAL(fr4.get_keyword("k1"), "v1");
+	BOOST_CHECK(arma::approx_equal(fr4.get_data(uvec({1, 2}), true), EVENT_DATA_VEC(dat.cols(1, 2)), "absdiff", 0));
+
+	auto fr5 = fr4.copy(uvec({0, 2}), true);
+	BOOST_CHECK(fr5->get_backend_type() == FileFormat::MMAP);
+	BOOST_CHECK_EQUAL(fr5->n_cols(), 2);
+	BOOST_CHECK(arma::approx_equal(fr5->get_data(), EVENT_DATA_VEC(fr4.get_data(uvec({0, 2}), true)), "absdiff", 0));
+
+	string copy_file = fr5->get_uri();
+	for(const auto & f : {copy_file, mmap_meta_path(copy_file)})
+	{
+		H5FileCache::instance().evict(f);
+		fs::remove(f);
+	}
+	H5FileCache::instance().evict(mmap_meta_path(mmapfile));
+	fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(shared_memory)
+{
+	if(!SharedMemory::is_supported())
+		return;
+	string h5file = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	H5_WRITE_PARAM param;
+	param.events_per_chunk = 1000;
+	fr.write_h5(h5file, param);
+	EVENT_DATA_VEC dat = fr.get_data();
+	CytoCtx ctx;
+	ctx.set_shared_memory(true);
+	//read-write frames are never shared
+	BOOST_CHECK(load_cytoframe(h5file, false, ctx)->get_backend_type() == FileFormat::H5);
+	BOOST_CHECK(dynamic_cast<SharedCytoFrame *>(load_cytoframe(h5file, false, ctx).get()) == nullptr);
+
+	auto ptr1 = load_cytoframe(h5file, true, ctx);
+	auto & fr1 = dynamic_cast<SharedCytoFrame &>(*ptr1);
+	BOOST_CHECK(fr1.is_shared());
+	BOOST_CHECK(fr1.get_backend_type() == FileFormat::H5);
+	BOOST_CHECK_EQUAL(fr1.get_uri(), h5file);
+	BOOST_CHECK_EQUAL(fr1.get_ref_count(), 1);
+	BOOST_CHECK(arma::approx_equal(fr1.get_data(), dat, "absdiff", 0));
+	BOOST_CHECK_EQUAL(fr1.get_keywords().size(), fr.get_keywords().size());
+	{
+		//attaches to the existing segment instead of reading the file again
+		auto ptr2 = load_cytoframe(h5file, true, ctx);
+		auto & fr2 = dynamic_cast<SharedCytoFrame &>(*ptr2);
+		BOOST_CHECK_EQUAL(fr1.get_ref_count(), 2);
+		BOOST_CHECK(arma::approx_equal(fr2.get_data(), dat, "absdiff", 0));
+		//the changes are private to the frame
+		auto ch = fr2.get_channels();
+		fr2.get_data_memptr(ch[0], ColType::channel)[3] = -1;
+		BOOST_CHECK_EQUAL(fr2.get_data()(3, 0), -1);
+		BOOST_CHECK_EQUAL(fr1.get_data()(3, 0), dat(3, 0));
+		//the copies share the segment
+		SharedCytoFrame fr3(fr1);
+		BOOST_CHECK_EQUAL(fr3.get_data_ref().memptr(), fr1.get_data_ref().memptr());
+		BOOST_CHECK_EQUAL(fr1.get_ref_count(), 2);
+	}
+	BOOST_CHECK_EQUAL(fr1.get_ref_count(), 1);
+
+	//the copy is written to h5
+	string h5copy = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+	auto fr4 = fr1.copy(h5copy);
+	BOOST_CHECK(fr4->get_backend_type() == FileFormat::H5);
+	BOOST_CHECK(arma::approx_equal(fr4->get_data(), dat, "absdiff", 0));
+	//in the layout of the source file
+	BOOST_CHECK_EQUAL(dynamic_cast<H5CytoFrame &>(*fr4).get_h5_write_param().events_per_chunk, 1000);
+	BOOST_CHECK_THROW(fr1.copy(h5copy), domain_error);
+	fr4 = fr1.copy(uvec({0, 2}), true, h5copy, true);
+	BOOST_CHECK_EQUAL(fr4->n_rows(), 2);
+	BOOST_CHECK_THROW(fr1.copy(h5file), domain_error);
+	BOOST_CHECK_THROW(fr1.copy(h5file, true), domain_error);
+	BOOST_CHECK(SharedCytoFrame::shared_memory_name(h5copy) != SharedCytoFrame::shared_memory_name(h5file));
+
+	//the segment is removed along with its last frame
+	ptr1.reset();
+	auto ptr5 = load_cytoframe(h5file, true, ctx);
+	BOOST_CHECK_EQUAL(dynamic_cast<SharedCytoFrame &>(*ptr5).get_ref_count(), 1);
+
+	//the stale segment doesn't unlink the one recreated under its name
+	string name = SharedMemory::name_from_key(h5file + "_stale");
+	auto fill = [](char * buf){buf[0] = 1;};
+	auto stale = make_shared<SharedMemory>(name, 1, fill);
+	SharedMemory::remove(name);
+	SharedMemory seg(name, 1, fill);
+	BOOST_CHECK(seg.is_creator());
+	stale.reset();
+	{
+		SharedMemory seg1(name, 1, fill);
+		BOOST_CHECK(!seg1.is_creator());
+		BOOST_CHECK_EQUAL(seg.ref_count(), 2);
+	}
+
+	ptr5.reset();
+	fr4.reset();
+	for(auto f : {h5file, h5copy})
+	{
+		H5FileCache::instance().evict(f);
+		fs::remove(f);
+	}
+}
 
 BOOST_AUTO_TEST_CASE(shallow_copy)
 {
@@ -239,6 +239,41 @@ BOOST_AUTO_TEST_CASE(template_constructor) {
 	BOOST_CHECK_EQUAL(vid.size(), 24);
 	BOOST_CHECK_EQUAL(gh1->getNodePath(vid[16]), "/not debris/singlets/CD3+/CD8/38+ DR-");
 }
+BOOST_AUTO_TEST_CASE(parallel_add_fcs) {
+	vector<pair<string, string>> id_vs_path;
+	for(auto i : {1, 2, 3, 4, 5})
+	{
+		string sn = "s" + to_string(i);
+		string file = i % 2 ? "../flowWorkspaceData/inst/extdata/CytoTrol_CytoTrol_1.fcs" : "../flowWorkspaceData/inst/extdata/CytoTrol_CytoTrol_2.fcs";
+		id_vs_path.push_back(make_pair(sn, file));
+	}
+	GatingSet cs1(id_vs_path);
+	GatingSet cs2(id_vs_path, FCS_READ_PARAM(), FileFormat::H5, fs_tmp_path(), CytoCtx("", "", "", 3));
+
+	BOOST_CHECK_EQUAL_COLLECTIONS(cs1.get_sample_uids().begin(), cs1.get_sample_uids().end()
+									, cs2.get_sample_uids().begin(), cs2.get_sample_uids().end());
+	for(const auto & sn : cs1.get_sample_uids())
+	{
+		auto fr1 = cs1.get_cytoframe_view(sn);
+		auto fr2 = cs2.get_cytoframe_view(sn);
+		BOOST_CHECK_EQUAL(fr1.get_pheno_data().at("name"), fr2.get_pheno_data().at("name"));
+		EVENT_DATA_VEC dat1 = fr1.get_data();
+		EVENT_DATA_VEC dat2 = fr2.get_data();
+		BOOST_CHECK_EQUAL_COLLECTIONS(dat1.begin(), dat1.end(), dat2.begin(), dat2.end());
+	}
+
+	//a bad file aborts the ingest
+	id_vs_path.push_back(make_pair("bad", "../flowCore/misc/nonexistent.fcs"));
+	BOOST_CHECK_THROW(GatingSet(id_vs_path, FCS_READ_PARAM(), FileFormat::H5, fs_tmp_path(), CytoCtx("", "", "", 3)), std::exception);
+
+	//the duplicated sample uid is rejected before any file is parsed or written
+	id_vs_path.back() = id_vs_path.front();
+	string dir = generate_unique_dir(fs::temp_directory_path().string(), "gs");
+	fs::create_directories(dir);
+	BOOST_CHECK_THROW(GatingSet(id_vs_path, FCS_READ_PARAM(), FileFormat::H5, dir, CytoCtx("", "", "", 3)), domain_error);
+	BOOST_CHECK(fs::is_empty(dir));
+	fs::remove_all(dir);
+}
 //BOOST_AUTO_TEST_CASE(subset_by_sample) {
 //	//check get_sample_uids
 //	vector<string> samples = gs.get_sample_uids();
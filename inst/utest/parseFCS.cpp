@@ -1,5 +1,6 @@
 #include <cytolib/MemCytoFrame.hpp>
 #include <cytolib/H5CytoFrame.hpp>
+#include <cytolib/FCSCatalog.hpp>
 #include "fixture.hpp"
 #include <cytolib/global.hpp>
 using namespace cytolib;
@@ -57,6 +58,18 @@ BOOST_AUTO_TEST_CASE(double_precision)
 	BOOST_CHECK_EQUAL(cytofrm.n_rows(), 250170);
 //	BOOST_CHECK_EQUAL_COLLECTIONS(myTest.isEqual.begin(), myTest.isEqual.end(),isTrue.begin(), isTrue.end());
 
+}
+BOOST_AUTO_TEST_CASE(multi_threads)
+{
+	string filename="../flowCore/misc/double_precision/wishbone_thymus_panel1_rep1.fcs";
+	FCS_READ_PARAM config;
+	config.data.num_threads = 1;
+	MemCytoFrame cf(filename.c_str(), config);
+	cf.read_fcs();
+	config.data.num_threads = 4;
+	MemCytoFrame cytofrm(filename.c_str(), config);
+	cytofrm.read_fcs();
+	BOOST_CHECK(arma::approx_equal(cf.get_data(), cytofrm.get_data(), "absdiff", 0));
 }
 BOOST_AUTO_TEST_CASE(multidata1)
 {
@@ -237,4 +250,158 @@ BOOST_AUTO_TEST_CASE(skip_log_transformed)
 	BOOST_CHECK_CLOSE(cytofrm.get_range("Dy161Di", ColType::channel, RangeType::instrument).second, 766, 1e-6);
 
 }
+BOOST_AUTO_TEST_CASE(mmap)
+{
+	string filename="../flowCore/misc/sample_1071.001";
+	FCS_READ_PARAM config;
+	MemCytoFrame cf1(filename.c_str(), config);
+	cf1.read_fcs();
+
+	config.data.use_mmap = true;
+	MemCytoFrame cf2(filename.c_str(), config);
+	cf2.read_fcs();
+	BOOST_CHECK_EQUAL(cf2.n_rows(), 23981);
+	BOOST_CHECK(arma::approx_equal(cf1.get_data(), cf2.get_data(), "absdiff", 0));
+
+	//mixed endian bytes are reordered in a copy of the mapped pages
+	filename="../flowCore/misc/mixedEndian.fcs";
+	MemCytoFrame cf3(filename.c_str(), config);
+	cf3.read_fcs();
+	BOOST_CHECK_EQUAL(cf3.get_data()[1], 7447226);
+
+	filename="../flowCore/misc/sample_1071.001";
+	config.data.which_lines = {10, 12};
+	MemCytoFrame cf4(filename.c_str(), config);
+	cf4.read_fcs();
+	BOOST_CHECK_EQUAL(cf4.n_rows(), 2);
+	BOOST_CHECK_EQUAL(cf4.get_data()[0], cf1.get_data()[10]);
+
+	//the truncated DATA segment is reported instead of reading past the mapping
+	string truncated = generate_unique_filename(fs::temp_directory_path().string(), "", ".fcs");
+	fs::copy_file(filename, truncated);
+	fs::resize_file(truncated, fs::file_size(truncated) - 4096);
+	config.data.which_lines.clear();
+	MemCytoFrame cf5(truncated.c_str(), config);
+	BOOST_CHECK_THROW(cf5.read_fcs(), domain_error);
+	fs::remove(truncated);
+}
+BOOST_AUTO_TEST_CASE(which_lines)
+{
+	string filename="../flowCore/misc/sample_1071.001";
+	FCS_READ_PARAM config;
+	MemCytoFrame cf1(filename.c_str(), config);
+	cf1.read_fcs();
+	auto dat1 = cf1.get_data();
+
+	//rows that are both adjacent and far apart end up in different coalesced reads
+	config.data.which_lines = {23980, 3, 4, 5, 9000, 4, 20000};
+	MemCytoFrame cf2(filename.c_str(), config);
+	cf2.read_fcs();
+	auto dat2 = cf2.get_data();
+	vector<int64_t> rows = {3, 4, 4, 5, 9000, 20000, 23980};
+	BOOST_CHECK_EQUAL(dat2.n_rows, rows.size());
+	for(unsigned i = 0; i < rows.size(); i++)
+		BOOST_CHECK_EQUAL(dat2(i, 1), dat1(rows[i], 1));
+
+	config.data.which_lines = {20000};
+	config.data.sample_without_replacement = true;
+	MemCytoFrame cf3(filename.c_str(), config);
+	cf3.read_fcs();
+	BOOST_CHECK_EQUAL(cf3.n_rows(), 20000);
+	//the sampled rows are sorted, so they match the distinct rows of the full data in order
+	auto dat3 = cf3.get_data();
+	bool is_matched = true;
+	unsigned j = 0;
+	for(unsigned i = 0; i < dat3.n_rows && is_matched; i++, j++)
+	{
+		while(j < dat1.n_rows && arma::any(dat1.row(j) != dat3.row(i)))
+			j++;
+		is_matched = j < dat1.n_rows;
+	}
+	BOOST_CHECK(is_matched);
+
+	//sampling all the rows but one without replacement reads each of them once
+	config.data.which_lines = {static_cast<int64_t>(dat1.n_rows) - 1};
+	MemCytoFrame cf4(filename.c_str(), config);
+	cf4.read_fcs();
+	auto dat4 = cf4.get_data();
+	unsigned k = 0;
+	while(k < dat4.n_rows && arma::all(dat4.row(k) == dat1.row(k)))
+		k++;
+	auto dat_left = dat1;
+	dat_left.shed_row(k);
+	BOOST_CHECK(arma::approx_equal(dat4, dat_left, "absdiff", 0));
+}
+BOOST_AUTO_TEST_CASE(select_channels)
+{
+	string filename="../flowCore/misc/sample_1071.001";
+	FCS_READ_PARAM config;
+	MemCytoFrame cf1(filename.c_str(), config);
+	cf1.read_fcs();
+	auto channels = cf1.get_channels();
+
+	config.data.channels = {channels[5], channels[0]};
+	MemCytoFrame cf2(filename.c_str(), config);
+	cf2.read_fcs();
+	BOOST_CHECK_EQUAL(cf2.n_cols(), 2);
+	BOOST_CHECK_EQUAL(cf2.n_rows(), cf1.n_rows());
+	BOOST_CHECK_EQUAL(cf2.get_channels()[0], channels[5]);
+	BOOST_CHECK(arma::approx_equal(cf2.get_data().col(0), cf1.get_data().col(5), "absdiff", 0));
+	BOOST_CHECK(arma::approx_equal(cf2.get_data().col(1), cf1.get_data().col(0), "absdiff", 0));
+	BOOST_CHECK_EQUAL(cf2.get_params()[0].min, cf1.get_params()[5].min);
+
+	config.data.channels = {"non-existing"};
+	MemCytoFrame cf3(filename.c_str(), config);
+	BOOST_CHECK_THROW(cf3.read_fcs(), domain_error);
+}
+BOOST_AUTO_TEST_CASE(header_catalog)
+{
+	//work on the copies so that they can be modified
+	string dir = generate_unique_dir(fs::temp_directory_path().string(), "catalog");
+	for(const auto & f : list_fcs_files("../flowWorkspace/wsTestSuite/curlyQuad/example1"))
+		fs::copy_file(f, fs::path(dir) / fs::path(f).filename());
+	auto files = list_fcs_files(dir);
+	BOOST_CHECK_GT(files.size(), 1);
+	string cache = (fs::path(dir) / "catalog.cache").string();
+
+	auto cat = read_fcs_header_catalog(files, FCS_READ_HEADER_PARAM(), 4, cache);
+	BOOST_CHECK_EQUAL(cat.n_parsed, files.size());
+	BOOST_CHECK_EQUAL(cat.files.size(), files.size());
+	BOOST_CHECK_EQUAL(cat.keywords.size(), cat.values.size());
+	auto tot = cat.get_column("$TOT");
+	BOOST_CHECK_EQUAL(tot.size(), files.size());
+
+	FCS_READ_PARAM config;
+	MemCytoFrame fr(files[0], config);
+	fr.read_fcs_header();
+	BOOST_CHECK_EQUAL(tot[0], fr.get_keyword("$TOT"));
+
+	//the repeat scan is served from the cache
+	auto cat1 = read_fcs_header_catalog(files, FCS_READ_HEADER_PARAM(), 4, cache);
+	BOOST_CHECK_EQUAL(cat1.n_parsed, 0);
+	BOOST_CHECK_EQUAL_COLLECTIONS(cat.keywords.begin(), cat.keywords.end(), cat1.keywords.begin(), cat1.keywords.end());
+	auto tot1 = cat1.get_column("$TOT");
+	BOOST_CHECK_EQUAL_COLLECTIONS(tot.begin(), tot.end(), tot1.begin(), tot1.end());
+
+	//the file rewritten at the same size (most likely within the same second) is parsed again
+	fs::copy_file(files[0], files[0] + ".bak");
+	fs::remove(files[0]);
+	fs::rename(files[0] + ".bak", files[0]);
+	auto cat2 = read_fcs_header_catalog(files, FCS_READ_HEADER_PARAM(), 4, cache);
+	BOOST_CHECK_EQUAL(cat2.n_parsed, 1);
+	BOOST_CHECK_EQUAL(cat2.get_column("$TOT")[0], tot[0]);
+
+	//the file deleted from the directory is dropped from the cache, so it is parsed again once it is back
+	string moved = files.back() + ".moved";
+	fs::rename(files.back(), moved);
+	vector<string> rest(files.begin(), files.end() - 1);
+	BOOST_CHECK_EQUAL(read_fcs_header_catalog(rest, FCS_READ_HEADER_PARAM(), 4, cache).n_parsed, 0);
+	fs::rename(moved, files.back());
+	BOOST_CHECK_EQUAL(read_fcs_header_catalog(files, FCS_READ_HEADER_PARAM(), 4, cache).n_parsed, 1);
+	//no temp file is left behind
+	for(const auto & e : fs::directory_iterator(dir))
+		BOOST_CHECK(e.path().extension() != ".tmp");
+
+	fs::remove_all(dir);
+}
 BOOST_AUTO_TEST_SUITE_END()
@@ -1,6 +1,7 @@
 // Copyright 2019 Fred Hutchinson Cancer Research Center
 // See the included LICENSE file for details on the licence that is granted to the user of this software.
 #include <cytolib/CytoFrame.hpp>
+#include <cytolib/H5FileCache.hpp>
 
 
 namespace cytolib
@@ -24,6 +25,7 @@ namespace cytolib
 	CytoFrame::CytoFrame(const CytoFrame & frm)
 	{
 //		cout << "copy CytoFrame member" << endl;
+		frm.ensure_meta_loaded();
 		pheno_data_ = frm.pheno_data_;
 		keys_ = frm.keys_;
 		params = frm.params;
@@ -33,6 +35,7 @@ namespace cytolib
 
 	CytoFrame & CytoFrame::operator=(const CytoFrame & frm)
 	{
+		frm.ensure_meta_loaded();
 		pheno_data_ = frm.pheno_data_;
 		keys_ = frm.keys_;
 		params = frm.params;
@@ -44,6 +47,7 @@ namespace cytolib
 
 	CytoFrame & CytoFrame::operator=(CytoFrame && frm)
 	{
+		frm.ensure_meta_loaded();
 		swap(pheno_data_, frm.pheno_data_);
 		swap(keys_, frm.keys_);
 		swap(params, frm.params);
@@ -55,6 +59,7 @@ namespace cytolib
 
 	CytoFrame::CytoFrame(CytoFrame && frm)
 	{
+		frm.ensure_meta_loaded();
 		swap(pheno_data_, frm.pheno_data_);
 		swap(keys_, frm.keys_);
 		swap(params, frm.params);
@@ -84,7 +89,6 @@ namespace cytolib
 	 */
 	void CytoFrame::compensate(const compensation& comp) {
 	  int nMarker = comp.marker.size();
-	  EVENT_DATA_VEC dat = get_data();
 	  arma::uvec indices(nMarker);
 	  for (int i = 0; i < nMarker; i++) {
 	    int id = get_col_idx(comp.marker[i], ColType::channel);
@@ -104,11 +108,9 @@ namespace cytolib
 	    
 	    indices_detector[i] = id;
 	  }
-	  arma::mat A(dat.memptr(), n_rows(), n_cols(), false,
-               true);  // point to the original data
-	  // Try to avoid extra memory burden from copies by performing
-	  // all of these transpositions in-place
-	  inplace_trans(A);
+	  EVENT_DATA_VEC dat = get_data(indices_detector, true);
+	  // only the detector columns are needed for the computation
+	  EVENT_DATA_VEC A = dat.t();
 	  arma::mat B = comp.get_spillover_mat();
 	  // B.print("comp");
 	  inplace_trans(B); //B is marker by detector 
@@ -116,14 +118,36 @@ namespace cytolib
 	  arma::mat R;
 	  qr_econ(Q, R, B);
 	  inplace_trans(Q);
-	  // Assign to rows representing t(X)
+	  // Compensated rows of t(X) for the markers
 	  // Note: trimatu to tell Armadillo that R is upper-triangular
 	  // so it goes straight to back-substitution
-	  A.rows(indices) = solve(trimatu(R), Q * A.rows(indices_detector));
-	  // Need to transpose A back to proper orientation
-	  //(which also takes care of transposing t(X) back to X)
+	  // the small spillover matrix is decomposed in double, the events are solved in EVENT_DATA_TYPE
+	  A = solve(trimatu(arma::conv_to<EVENT_DATA_VEC>::from(R)), arma::conv_to<EVENT_DATA_VEC>::from(Q) * A);
+	  // transpose it back to X and write the marker columns only
 	  inplace_trans(A);
-	  set_data(dat);
+	  set_data(A, indices);
+	}
+
+	void CytoFrame::check_set_data_cols(const EVENT_DATA_VEC & data_in, const uvec & col_idx) const
+	{
+		if(data_in.n_cols != col_idx.size())
+			throw(domain_error("The number of the input columns is different from the number of column indices!"));
+		if(data_in.n_rows != n_rows())
+			throw(domain_error("The number of the input rows is different from the cytoframe!"));
+		if(col_idx.is_empty())
+			return;
+		if(col_idx.max() >= n_cols())
+			throw(domain_error("column index out of bound: " + to_string(col_idx.max())));
+		if(arma::uvec(arma::unique(col_idx)).size() != col_idx.size())
+			throw(domain_error("Duplicate column indices detected!"));
+	}
+
+	void CytoFrame::set_data(const EVENT_DATA_VEC & data_in, uvec col_idx)
+	{
+		check_set_data_cols(data_in, col_idx);
+		EVENT_DATA_VEC dat = get_data();
+		dat.cols(col_idx) = data_in;
+		set_data(dat);
 	}
 
 	void CytoFrame::scale_time_channel(string time_channel){
@@ -133,13 +157,13 @@ namespace cytolib
 			EVENT_DATA_TYPE timestep = get_time_step(time_channel);
 			if(g_loglevel>=GATING_HIERARCHY_LEVEL)
 				PRINT("multiplying "+time_channel+" by :"+ to_string(timestep) + "\n");
-			//TODO:partial IO
-			EVENT_DATA_VEC data = get_data();;//get_data(idx);
-			EVENT_DATA_TYPE * x = data.colptr(idx);
+			uvec col_idx = {static_cast<arma::uword>(idx)};
+			EVENT_DATA_VEC data = get_data(col_idx, true);
+			EVENT_DATA_TYPE * x = data.memptr();
 			int nEvents = n_rows();
 			for(int i = 0; i < nEvents; i++)
 				x[i] = x[i] * timestep;
-			set_data(data);
+			set_data(data, col_idx);
 			//TODO:update instrument range as well
 			auto param_range = get_range(time_channel, ColType::channel, RangeType::data);
 			param_range.first = param_range.first * timestep;
@@ -258,6 +282,8 @@ namespace cytolib
 			datatype.setOrder(is_host_big_endian()?H5T_ORDER_BE:H5T_ORDER_LE );
 			return datatype;
 		}
+		else if(is_same<EVENT_DATA_TYPE, float>::value)
+			return FloatType(PredType::NATIVE_FLOAT);//no conversion between the float32 events and h5
 		else
 			return FloatType(PredType::NATIVE_DOUBLE);
 	}
@@ -295,7 +321,99 @@ namespace cytolib
 		return key_type;
 
 	}
-	void CytoFrame::write_h5_params(H5File file) const
+	static void check_h5_filter(H5Z_filter_t filter, const string & name)
+	{
+		if(H5Zfilter_avail(filter) <= 0)
+			throw(domain_error("hdf5 filter plugin '" + name + "' is not available! Please check HDF5_PLUGIN_PATH"));
+	}
+
+	DSetCreatPropList h5_events_plist(const H5_WRITE_PARAM & param, hsize_t nCol, hsize_t nEvents)
+	{
+		DSetCreatPropList plist;
+		hsize_t nChunkRow = param.events_per_chunk > 0 ? min<hsize_t>(param.events_per_chunk, nEvents) : nEvents;
+		hsize_t nChunkCol = min<hsize_t>(max<size_t>(param.channels_per_chunk, 1), nCol);
+		hsize_t	chunk_dims[2] = {max<hsize_t>(nChunkCol, 1), max<hsize_t>(nChunkRow, 1)};
+		plist.setChunk(2, chunk_dims);
+
+		//shuffle only pays off in front of a compressor
+		if(param.shuffle && param.compression != H5Compression::none)
+			plist.setShuffle();
+		switch(param.compression)
+		{
+		case H5Compression::none:
+			break;
+		case H5Compression::deflate:
+			plist.setDeflate(param.compression_level < 0 ? 6 : param.compression_level);
+			break;
+		case H5Compression::lz4:
+			check_h5_filter(H5_FILTER_LZ4, "lz4");
+			plist.setFilter(H5_FILTER_LZ4, H5Z_FLAG_MANDATORY);
+			break;
+		case H5Compression::zstd:
+		{
+			check_h5_filter(H5_FILTER_ZSTD, "zstd");
+			unsigned level = param.compression_level < 0 ? 3 : param.compression_level;
+			plist.setFilter(H5_FILTER_ZSTD, H5Z_FLAG_MANDATORY, 1, &level);
+			break;
+		}
+		default:
+			throw(domain_error("invalid compression!"));
+		}
+		return plist;
+	}
+
+	FileAccPropList h5_create_plist(const H5_WRITE_PARAM & param)
+	{
+		FileAccPropList fapl;
+		if(param.swmr)
+			fapl.setLibverBounds(H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+		return fapl;
+	}
+
+	H5_WRITE_PARAM h5_events_param(const DataSet & dataset)
+	{
+		H5_WRITE_PARAM param;
+		DSetCreatPropList plist = dataset.getCreatePlist();
+		if(plist.getLayout() != H5D_CHUNKED)
+			return param;
+		hsize_t chunk_dims[2], dims[2];
+		plist.getChunk(2, chunk_dims);
+		dataset.getSpace().getSimpleExtentDims(dims);
+		param.channels_per_chunk = chunk_dims[0];
+		//the chunk that spans all the events is kept that way for the derived files
+		param.events_per_chunk = chunk_dims[1] >= dims[1] ? 0 : chunk_dims[1];
+
+		int nFilter = plist.getNfilters();
+		for(int i = 0; i < nFilter; i++)
+		{
+			unsigned flags, filter_config;
+			size_t nCd = 8;
+			unsigned cd_values[8];
+			char name[64];
+			H5Z_filter_t filter = plist.getFilter(i, flags, nCd, cd_values, sizeof(name), name, filter_config);
+			switch(filter)
+			{
+			case H5Z_FILTER_SHUFFLE:
+				param.shuffle = true;
+				break;
+			case H5Z_FILTER_DEFLATE:
+				param.compression = H5Compression::deflate;
+				param.compression_level = nCd > 0 ? cd_values[0] : -1;
+				break;
+			case H5_FILTER_LZ4:
+				param.compression = H5Compression::lz4;
+				break;
+			case H5_FILTER_ZSTD:
+				param.compression = H5Compression::zstd;
+				param.compression_level = nCd > 0 ? cd_values[0] : -1;
+				break;
+			default:
+				break;
+			}
+		}
+		return param;
+	}
+	void CytoFrame::write_h5_params(const H5Location & loc) const
 	{
 		hsize_t dim_param[] = {n_cols()};
 		hsize_t dim_max[] = {H5S_UNLIMITED};
@@ -307,7 +425,7 @@ namespace cytolib
 			hsize_t chunk_dim[] ={1};
 			plist.setChunk(1, chunk_dim);
 		}
-		DataSet ds = file.createDataSet( "params", get_h5_datatype_params(DataTypeLocation::H5), dsp_param, plist);
+		DataSet ds = loc.createDataSet( "params", get_h5_datatype_params(DataTypeLocation::H5), dsp_param, plist);
 		auto params_char = params_c_str();
 		ds.write(&params_char[0], get_h5_datatype_params(DataTypeLocation::MEM));
 	}
@@ -316,6 +434,7 @@ namespace cytolib
 	 * @return
 	 */
 	vector<cytoParam_cstr> CytoFrame::params_c_str() const{
+		ensure_meta_loaded();
 		auto nParams = params.size();
 		vector<cytoParam_cstr> res(nParams);
 		for(unsigned i = 0; i < nParams; i++)
@@ -332,7 +451,7 @@ namespace cytolib
 		return res;
 	}
 
-	void CytoFrame::write_h5_keys(H5File file) const
+	void CytoFrame::write_h5_keys(const H5Location & loc) const
 	{
 		CompType key_type = get_h5_datatype_keys();
 		hsize_t dim_key[] = {keys_.size()};
@@ -345,13 +464,13 @@ namespace cytolib
 //		else{
 //			hsize_t chunk_dim[] ={1};
 //		}
-		DataSet ds = file.createDataSet( "keywords", key_type, dsp_key, plist);
+		DataSet ds = loc.createDataSet( "keywords", key_type, dsp_key, plist);
 
 		auto keyVec = to_kw_vec<KEY_WORDS>(keys_);
 		ds.write(&keyVec[0], key_type );
 
 	}
-	void CytoFrame::write_h5_pheno_data(H5File file) const
+	void CytoFrame::write_h5_pheno_data(const H5Location & loc) const
 	{
 		CompType key_type = get_h5_datatype_keys();
 		hsize_t nSize = pheno_data_.size();
@@ -368,7 +487,7 @@ namespace cytolib
 			plist.setChunk(1, chunk_dim);
 		}
 
-		DataSet ds = file.createDataSet( "pdata", key_type, dsp_pd, plist);
+		DataSet ds = loc.createDataSet( "pdata", key_type, dsp_pd, plist);
 
 		auto keyVec = to_kw_vec<PDATA>(pheno_data_);
 		ds.write(&keyVec[0], key_type );
@@ -379,15 +498,22 @@ namespace cytolib
 	 *
 	 * @param filename the path of the output H5 file
 	 */
-	void CytoFrame::write_h5(const string & filename) const
+	void CytoFrame::write_h5(const string & filename, const H5_WRITE_PARAM & param) const
 	{
-		H5File file( filename, H5F_ACC_TRUNC );
+		//the file can't be truncated while it is still held open by the cache
+		H5FileCache::instance().evict(filename);
+		H5File file( filename, H5F_ACC_TRUNC, FileCreatPropList::DEFAULT, h5_create_plist(param));
+		write_h5_group(file, param);
+	}
 
-		write_h5_params(file);
+	void CytoFrame::write_h5_group(const H5Location & loc, const H5_WRITE_PARAM & param) const
+	{
+		ensure_meta_loaded();
+		write_h5_params(loc);
 
-		write_h5_keys(file);
+		write_h5_keys(loc);
 
-		write_h5_pheno_data(file);
+		write_h5_pheno_data(loc);
 
 
 		 /*
@@ -396,14 +522,11 @@ namespace cytolib
 		*/
 		unsigned nEvents = n_rows();
 		hsize_t dimsf[2] = {n_cols(), nEvents};              // dataset dimensions
-		DSetCreatPropList plist;
-		hsize_t	chunk_dims[2] = {1, (nEvents > 0 ? nEvents : 1)};
-		plist.setChunk(2, chunk_dims);
-	//	plist.setFilter()
+		DSetCreatPropList plist = h5_events_plist(param, n_cols(), nEvents);
 		hsize_t dim_max[] = {H5S_UNLIMITED, H5S_UNLIMITED};
 
 		DataSpace dataspace( 2, dimsf, dim_max);
-		DataSet dataset = file.createDataSet( DATASET_NAME, h5_datatype_data(DataTypeLocation::H5), dataspace, plist);
+		DataSet dataset = loc.createDataSet( DATASET_NAME, h5_datatype_data(DataTypeLocation::H5), dataspace, plist);
 		/*
 		* Write the data to the dataset using default memory space, file
 		* space, and transfer properties.
@@ -411,8 +534,7 @@ namespace cytolib
 		EVENT_DATA_VEC dat = get_data();
 		dataset.write(dat.mem, h5_datatype_data(DataTypeLocation::MEM));
 
-		auto rn = get_rownames();
-		write_h5_rownames(file, rn);
+		write_h5_rownames(loc, get_compact_rownames(), param.legacy_rownames);
 	}
 
 
@@ -424,6 +546,7 @@ namespace cytolib
 	 */
 	string CytoFrame::get_keyword(const string & key) const
 	{
+		ensure_meta_loaded();
 		string res="";
 		auto it = keys_.find(key);
 		if(it!=keys_.end())
@@ -433,6 +556,7 @@ namespace cytolib
 
 	void CytoFrame::subset_parameters(uvec col_idx)
 	{
+			ensure_meta_loaded();
 			unsigned n = col_idx.size();
 			vector<cytoParam> params_new(n);
 			for(unsigned i = 0; i < n; i++)
@@ -636,6 +760,7 @@ namespace cytolib
 	EVENT_DATA_TYPE CytoFrame::get_time_step(const string time_channel) const
 	{
 
+		ensure_meta_loaded();
 	  //check if $TIMESTEP is available
 		EVENT_DATA_TYPE ts;
 		auto it_time = keys_.find("$TIMESTEP");
@@ -667,6 +792,7 @@ namespace cytolib
 
 
 	string CytoFrame::get_pheno_data(const string & name) const {
+		ensure_meta_loaded();
 		auto it = pheno_data_.find(name);
 		if(it==pheno_data_.end())
 			return "";
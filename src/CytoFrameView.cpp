@@ -190,6 +190,32 @@ namespace cytolib
 			get_cytoframe_ptr()->set_data(data_orig);
 		}
 	}
+	void CytoFrameView::set_data(const EVENT_DATA_VEC & data_in, uvec col_idx){
+		if(is_empty()){
+			if(!data_in.is_empty()){
+				throw(domain_error("Cannot assign non-empty input data to empty CytoFrameView!"));
+			}
+			return;
+		}
+		if(data_in.n_cols != col_idx.size() || data_in.n_rows != n_rows())
+			throw(domain_error("The size of the input data is different from the cytoframeview!"));
+		if(!col_idx.is_empty() && col_idx.max() >= n_cols())
+			throw(domain_error("column index out of bound: " + to_string(col_idx.max())));
+		//map to the columns of the original frame
+		if(is_col_indexed_)
+			for(auto & i : col_idx)
+				i = col_idx_[i];
+		auto ptr = get_cytoframe_ptr();
+		if(is_row_indexed_)
+		{
+			//only the rows in the view are updated
+			EVENT_DATA_VEC data_orig = ptr->get_data(col_idx, true);
+			data_orig.rows(row_idx_) = data_in;
+			ptr->set_data(data_orig, col_idx);
+		}
+		else
+			ptr->set_data(data_in, col_idx);
+	}
 	EVENT_DATA_VEC CytoFrameView::get_data() const
 	{
 		EVENT_DATA_VEC data;
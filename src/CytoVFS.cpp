@@ -15,13 +15,13 @@ namespace cytolib
 	 */
 
 	//dummy
-	CytoCtx::CytoCtx():access_key_id_(""),access_key_(""),region_("us-west-1"),num_threads_(1){};
+	CytoCtx::CytoCtx():access_key_id_(""),access_key_(""),region_("us-west-1"),num_threads_(1),h5_container_(false),h5_lazy_load_(false),shared_memory_(false){};
 	//dummy
 	CytoCtx::CytoCtx(const string & secret_id
 						, const string & secret_key
 						, const string & aws_region
 						, int num_threads):access_key_id_(secret_id)
-			, access_key_(secret_key), region_(aws_region), num_threads_(num_threads){};
+			, access_key_(secret_key), region_(aws_region), num_threads_(num_threads),h5_container_(false),h5_lazy_load_(false),shared_memory_(false){};
 	//dummy
 	void CytoCtx::init_ctxptr(){}
 	//dummy
@@ -0,0 +1,299 @@
+// Copyright 2019 Fred Hutchinson Cancer Research Center
+// See the included LICENSE file for details on the licence that is granted to the user of this software.
+#include <cytolib/FCSCatalog.hpp>
+#include <cytolib/global.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+namespace fs = boost::filesystem;
+
+namespace cytolib
+{
+	const string FCS_CATALOG_CACHE_MAGIC = "CYTOLIB_FCS_CATALOG";
+	const uint32_t FCS_CATALOG_CACHE_VERSION = 2;
+
+	/**
+	 * the cached keywords of a single file along with the file stats they are valid for
+	 */
+	struct FCS_CATALOG_ENTRY{
+		uint64_t size;
+		int64_t mtime;//in nanoseconds
+		KW_PAIR kw;
+	};
+	typedef unordered_map<string, FCS_CATALOG_ENTRY> FCS_CATALOG_CACHE;
+
+	/*
+	 * cache file layout (all integers in host byte order, strings are length-prefixed):
+	 * magic, version, config signature, number of entries
+	 * and for each entry: path, size, mtime, number of keywords, key/value pairs
+	 */
+	static void write_u64(ostream & out, uint64_t v){out.write(reinterpret_cast<const char *>(&v), sizeof(v));}
+	static uint64_t read_u64(istream & in){
+		uint64_t v = 0;
+		in.read(reinterpret_cast<char *>(&v), sizeof(v));
+		if(!in)
+			throw(domain_error("unexpected end of the cache file"));
+		return v;
+	}
+	static void write_str(ostream & out, const string & s){
+		write_u64(out, s.size());
+		out.write(s.data(), s.size());
+	}
+	static string read_str(istream & in){
+		uint64_t n = read_u64(in);
+		string s(n, '\0');
+		in.read(&s[0], n);
+		if(!in)
+			throw(domain_error("unexpected end of the cache file"));
+		return s;
+	}
+	/**
+	 * the modification time in nanoseconds, since a file rewritten within the same second would be served stale otherwise
+	 */
+	static int64_t file_mtime(const string & file){
+#ifndef _WIN32
+		struct stat st;
+		if(stat(file.c_str(), &st) != 0)
+			throw(domain_error("can't stat the file: " + file));
+#ifdef __APPLE__
+		const struct timespec & t = st.st_mtimespec;
+#else
+		const struct timespec & t = st.st_mtim;
+#endif
+		return static_cast<int64_t>(t.tv_sec) * 1000000000 + t.tv_nsec;
+#else
+		return static_cast<int64_t>(fs::last_write_time(file)) * 1000000000;
+#endif
+	}
+	/**
+	 * the header parsing arguments that affect the parsed keywords, so that the cache is discarded when they change
+	 */
+	static string config_signature(const FCS_READ_HEADER_PARAM & config){
+		return to_string(config.isEmptyKeyValue) + to_string(config.ignoreTextOffset) + to_string(config.nDataset);
+	}
+
+	/**
+	 * load the cache. Returns empty cache when the file doesn't exist or is not valid
+	 */
+	static FCS_CATALOG_CACHE load_catalog_cache(const string & cache_file, const string & signature){
+		FCS_CATALOG_CACHE cache;
+		ifstream in(cache_file, ios::in | ios::binary);
+		if(!in)
+			return cache;
+		try
+		{
+			if(read_str(in) != FCS_CATALOG_CACHE_MAGIC || read_u64(in) != FCS_CATALOG_CACHE_VERSION || read_str(in) != signature)
+				return cache;
+			uint64_t nEntry = read_u64(in);
+			for(uint64_t i = 0; i < nEntry; i++)
+			{
+				string path = read_str(in);
+				FCS_CATALOG_ENTRY & entry = cache[path];
+				entry.size = read_u64(in);
+				entry.mtime = static_cast<int64_t>(read_u64(in));
+				uint64_t nKw = read_u64(in);
+				entry.kw.resize(nKw);
+				for(auto & p : entry.kw)
+				{
+					p.first = read_str(in);
+					p.second = read_str(in);
+				}
+			}
+		}
+		catch(const domain_error &)
+		{
+			//a truncated cache is simply rebuilt
+			cache.clear();
+		}
+		return cache;
+	}
+
+	static void save_catalog_cache(const string & cache_file, const string & signature, const FCS_CATALOG_CACHE & cache){
+		/*
+		 * write to a temp file first so that an interrupted scan never leaves a partial cache behind.
+		 * It is unique so that the concurrent scans of the same directory don't write to the same one
+		 */
+		fs::path cache_path(cache_file);
+		fs::path cache_dir = cache_path.has_parent_path() ? cache_path.parent_path() : fs::path(".");
+		string tmp = generate_unique_filename(cache_dir.string(), cache_path.filename().string() + ".", ".tmp");
+		try
+		{
+			ofstream out(tmp, ios::out | ios::binary | ios::trunc);
+			if(!out)
+				throw(domain_error("can't write the catalog cache: " + tmp));
+			write_str(out, FCS_CATALOG_CACHE_MAGIC);
+			write_u64(out, FCS_CATALOG_CACHE_VERSION);
+			write_str(out, signature);
+			write_u64(out, cache.size());
+			for(const auto & it : cache)
+			{
+				write_str(out, it.first);
+				write_u64(out, it.second.size);
+				write_u64(out, static_cast<uint64_t>(it.second.mtime));
+				write_u64(out, it.second.kw.size());
+				for(const auto & p : it.second.kw)
+				{
+					write_str(out, p.first);
+					write_str(out, p.second);
+				}
+			}
+			if(!out)
+				throw(domain_error("failed to write the catalog cache: " + tmp));
+			out.close();
+			fs::rename(tmp, cache_file);
+		}
+		catch(...)
+		{
+			boost::system::error_code ec;
+			fs::remove(tmp, ec);
+			throw;
+		}
+	}
+
+	vector<string> FCS_CATALOG::get_column(const string & keyword) const
+	{
+		for(size_t k = 0; k < keywords.size(); k++)
+			if(keywords[k] == keyword)
+				return values[k];
+		return vector<string>();
+	}
+
+	FCS_CATALOG read_fcs_header_catalog(const vector<string> & files
+			, const FCS_READ_HEADER_PARAM & config
+			, int num_threads
+			, const string & cache_file)
+	{
+		size_t nFile = files.size();
+		string signature = config_signature(config);
+		FCS_CATALOG_CACHE cache;
+		if(!cache_file.empty())
+			cache = load_catalog_cache(cache_file, signature);
+
+		/*
+		 * stat all the files and pick the ones that need to be parsed
+		 */
+		vector<FCS_CATALOG_ENTRY> entries(nFile);
+		vector<size_t> to_parse;
+		for(size_t i = 0; i < nFile; i++)
+		{
+			const string & file = files[i];
+			if(!fs::exists(file))
+				throw(domain_error("FCS file not found: " + file));
+			entries[i].size = fs::file_size(file);
+			entries[i].mtime = file_mtime(file);
+			auto it = cache.find(file);
+			if(it != cache.end() && it->second.size == entries[i].size && it->second.mtime == entries[i].mtime)
+				entries[i].kw = it->second.kw;
+			else
+				to_parse.push_back(i);
+		}
+
+		/*
+		 * parse headers in parallel. Each worker claims the next file until all are done.
+		 * PRINT may call the R API, which is only safe from the calling thread,
+		 * so the messages of each file are collected and printed after the workers are done
+		 */
+		size_t nWorker = min<size_t>(max(num_threads, 1), to_parse.size());
+		vector<string> msgs(nFile);
+		atomic<size_t> next_file(0);
+		mutex err_mutex;
+		exception_ptr err;
+		auto parse_headers = [&](){
+			size_t j;
+			while((j = next_file++) < to_parse.size())
+			{
+				size_t i = to_parse[j];
+				PrintBuffer msg;
+				try
+				{
+					FCS_READ_PARAM fcs_config;
+					fcs_config.header = config;
+					MemCytoFrame fr(files[i], fcs_config);
+					fr.read_fcs_header();
+					entries[i].kw = fr.get_keywords().getPairs();
+				}
+				catch(const exception & e)
+				{
+					lock_guard<mutex> lock(err_mutex);
+					if(!err)
+						err = make_exception_ptr(domain_error(files[i] + ": " + e.what()));
+					next_file = to_parse.size();//stop the rest of the workers
+				}
+				msgs[i] = msg.str();
+			}
+		};
+		if(nWorker <= 1)
+			parse_headers();
+		else
+		{
+			vector<thread> workers;
+			for(size_t t = 0; t < nWorker; t++)
+				workers.emplace_back(parse_headers);
+			for(auto & w : workers)
+				w.join();
+		}
+		for(const auto & msg : msgs)
+			if(!msg.empty())
+				PRINT(msg);
+		if(err)
+			rethrow_exception(err);
+
+		if(!cache_file.empty())
+		{
+			//the files that are not part of this scan (e.g. the deleted ones) are dropped from the cache
+			FCS_CATALOG_CACHE scanned;
+			for(size_t i = 0; i < nFile; i++)
+				scanned[files[i]] = entries[i];
+			if(to_parse.size() > 0 || scanned.size() != cache.size())
+				save_catalog_cache(cache_file, signature, scanned);
+		}
+
+		/*
+		 * pivot to the columnar table
+		 */
+		FCS_CATALOG res;
+		res.files = files;
+		res.n_parsed = to_parse.size();
+		unordered_map<string, size_t> col_idx;
+		for(size_t i = 0; i < nFile; i++)
+		{
+			for(const auto & p : entries[i].kw)
+			{
+				auto it = col_idx.find(p.first);
+				size_t k;
+				if(it == col_idx.end())
+				{
+					k = res.keywords.size();
+					col_idx[p.first] = k;
+					res.keywords.push_back(p.first);
+					res.values.push_back(vector<string>(nFile));
+				}
+				else
+					k = it->second;
+				res.values[k][i] = p.second;
+			}
+		}
+		return res;
+	}
+
+	vector<string> list_fcs_files(const string & dir)
+	{
+		if(!fs::is_directory(dir))
+			throw(domain_error("Not a directory: " + dir));
+		vector<string> res;
+		for(auto & e : fs::directory_iterator(dir))
+		{
+			fs::path p = e;
+			if(fs::is_regular_file(p) && boost::iequals(p.extension().string(), ".fcs"))
+				res.push_back(p.string());
+		}
+		sort(res.begin(), res.end());
+		return res;
+	}
+};
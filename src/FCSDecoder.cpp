@@ -0,0 +1,48 @@
+// Copyright 2019 Fred Hutchinson Cancer Research Center
+// See the included LICENSE file for details on the licence that is granted to the user of this software.
+#include <cytolib/FCSDecoder.hpp>
+#include <stdexcept>
+
+namespace cytolib
+{
+	template<bool swap>
+	FCS_DECODER get_fcs_decoder(const string & dattype, int nbytes)
+	{
+		if(dattype == "I")
+		{
+			switch(nbytes)
+			{
+			case 1:
+				return decode_uint<uint8_t, swap>;
+			case 2:
+				return decode_uint<uint16_t, swap>;
+			case 4:
+				return decode_uint<uint32_t, swap>;
+			case 8:
+				return decode_uint<uint64_t, swap>;
+			default:
+				throw std::range_error("unsupported byte width :" + std::to_string(nbytes));
+			}
+		}
+		else
+		{
+			switch(nbytes)
+			{
+			case 4:
+				return decode_float<float, uint32_t, swap>;
+			case 8:
+				return decode_float<double, uint64_t, swap>;
+			default:
+				throw std::range_error("Unsupported bitwidths for numerical data type:" + std::to_string(nbytes));
+			}
+		}
+	}
+
+	FCS_DECODER get_fcs_decoder(const string & dattype, int nbytes, bool isbyteswap)
+	{
+		if(isbyteswap)
+			return get_fcs_decoder<true>(dattype, nbytes);
+		else
+			return get_fcs_decoder<false>(dattype, nbytes);
+	}
+};
@@ -2,6 +2,9 @@
 // See the included LICENSE file for details on the licence that is granted to the user of this software.
 #include <cytolib/GatingHierarchy.hpp>
 #include <cytolib/global.hpp>
+#include <cytolib/H5ContainerCytoFrame.hpp>
+#include <cytolib/MappedCytoFrame.hpp>
+#include <cytolib/SharedCytoFrame.hpp>
 #include <boost/graph/graphviz.hpp>
 #include <boost/graph/graph_traits.hpp>
 #include <boost/graph/topological_sort.hpp>
@@ -12,14 +15,39 @@ namespace fs = boost::filesystem;
 
 namespace cytolib
 {
+	/**
+	 * keep the events of the read-only frame in shared memory when it is requested by ctx
+	 */
+	static CytoFramePtr share_cytoframe(CytoFramePtr ptr, bool readonly, const CytoCtx & ctx)
+	{
+		if(ctx.get_shared_memory() && readonly && SharedMemory::is_supported())
+			ptr.reset(new SharedCytoFrame(ptr));
+		return ptr;
+	}
 	CytoFramePtr load_cytoframe(const string & uri, bool readonly, CytoCtx ctx)
 	{
 		 CytoFramePtr ptr;
 
 		CytoVFS vfs(ctx);
+		string container, sample_uid;
+		if(parse_h5_container_uri(uri, container, sample_uid))
+		{
+			if(!vfs.is_file(container))
+				throw(domain_error("h5 container missing for sample: " + uri));
+			if(!ctx.get_h5_lazy_load() && !has_h5_container_sample(container, sample_uid))
+				throw(domain_error("cytoframe missing from h5 container for sample: " + uri));
+			ptr.reset(new H5ContainerCytoFrame(container, sample_uid, readonly, !ctx.get_h5_lazy_load()));
+			return share_cytoframe(ptr, readonly, ctx);
+		}
 		 bool is_exist = vfs.is_file(uri);
 		if(!is_exist)
 		 throw(domain_error("cytoframe file missing for sample: " + uri));
+		//the mapped events are already shared by the processes through the page cache
+		if(fs::path(uri).extension().string() == MMAP_EXT)
+		{
+			ptr.reset(new MappedCytoFrame(uri, readonly));
+			return ptr;
+		}
 		if(is_remote_path(uri))
 		{
 
@@ -29,10 +57,10 @@ namespace cytolib
 		else
 		{
 
-				ptr.reset(new H5CytoFrame(uri, readonly));
+				ptr.reset(new H5CytoFrame(uri, readonly, !ctx.get_h5_lazy_load()));
 
 		}
-		return ptr;
+		return share_cytoframe(ptr, readonly, ctx);
 	}
 	/**
 	 * setter for channels (dedicated fro Rcpp API and  it won't throw on the unmatched old channel name)
@@ -283,6 +311,15 @@ namespace cytolib
 			}
 	}
 
+	/**
+	 * the extension of the cytoframe file saved for the frame, the memory mapped frames are saved as they are and others as h5
+	 */
+	static string cf_file_ext(const CytoFrameView & frame, const string & cf_filename)
+	{
+		if(is_h5_container_uri(cf_filename))
+			return "";
+		return frame.get_backend_type() == FileFormat::MMAP ? MMAP_EXT : ".h5";
+	}
 	/**
 	 *
 	 * @param gh_pb
@@ -333,7 +370,7 @@ namespace cytolib
 			frame_.set_readonly(false);//temporary unlock it
 			frame_.flush_meta();
 			frame_.set_readonly(flag);//restore the lock
-			string ext= ".h5";
+			string ext= cf_file_ext(frame_, cf_filename);
 
 			frame_.convertToPb(*fr_pb, cf_filename + ext, h5_opt, ctx);
 		}
@@ -1645,7 +1682,7 @@ namespace cytolib
 		res->trans = trans.copy();
 		if(is_copy_data)
 		{
-			string ext= ".h5";
+			string ext= cf_file_ext(frame_, cf_filename);
 
 			if(is_realize_data)
 				res->frame_ = frame_.copy_realized(cf_filename + ext);
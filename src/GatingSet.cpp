@@ -2,9 +2,15 @@
 // See the included LICENSE file for details on the licence that is granted to the user of this software.
 #include <cytolib/GatingSet.hpp>
 #include <cytolib/H5CytoFrame.hpp>
+#include <cytolib/H5ContainerCytoFrame.hpp>
 #include <cytolib/MemCytoFrame.hpp>
+#include <cytolib/BoundedQueue.hpp>
 #include <cytolib/cytolibConfig.h>
 #include <boost/filesystem.hpp>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <set>
 namespace fs = boost::filesystem;
 
 
@@ -25,9 +31,12 @@ namespace cytolib
 
 		string errmsg = "Not a valid GatingSet archiving folder! " + path + "\n";
 		fs::path gs_pb_file;
+		string h5_container;
 		unordered_set<string> cf_samples;
+		unordered_set<string> h5_container_samples;
+		unordered_set<string> mmap_samples;
 		unordered_set<string> pb_samples;
-		FileFormat fmt;
+		FileFormat fmt = FileFormat::H5;
 		//search for h5
 		CytoVFS vfs(ctx);
 		for(auto & e : vfs.ls(path))
@@ -39,6 +48,22 @@ namespace cytolib
 			{
 					cf_samples.insert(fn);
 			}
+			else if(ext == MMAP_EXT)
+			{
+				mmap_samples.insert(fn);
+			}
+			else if(ext == MMAP_META_EXT)
+			{
+				//the sidecar of the memory mapped cytoframe, which is loaded along with its events file
+			}
+			else if(ext == H5_CONTAINER_EXT)
+			{
+				if(!h5_container.empty())
+					throw(domain_error(errmsg + "Multiple h5 containers found for the same gs object!"));
+				h5_container = p.string();
+				for(const auto & sn : list_h5_container(h5_container))
+					h5_container_samples.insert(sn);
+			}
 			else if(ext == ".pb")
 			{
 				pb_samples.insert(fn);
@@ -55,6 +80,13 @@ namespace cytolib
 				throw(domain_error(errmsg + "File not recognized: " + p.string()));
 		}
 
+		for(const auto & sn : h5_container_samples)
+			if(!cf_samples.insert(sn).second)
+				throw(domain_error(errmsg + "cytoframe of sample " + sn + " found in both h5 file and h5 container!"));
+		for(const auto & sn : mmap_samples)
+			if(!cf_samples.insert(sn).second)
+				throw(domain_error(errmsg + "cytoframe of sample " + sn + " found in multiple formats!"));
+
 		bool is_legacy = false;
 		if(gs_pb_file.empty())
 		{
@@ -180,8 +212,14 @@ namespace cytolib
 
 					string uri;
 					auto cf_ext = "." + fmt_to_str(fmt);
-					uri = (fs::path(path) / (sn + cf_ext)).string();
-					add_GatingHierarchy(GatingHierarchyPtr(new GatingHierarchy(ctx_, gh_pb, uri, is_skip_data, readonly)), sn);
+					if(h5_container_samples.find(sn) != h5_container_samples.end())
+						uri = h5_container_uri(h5_container, sn);
+					else if(mmap_samples.find(sn) != mmap_samples.end())
+						uri = (fs::path(path) / (sn + MMAP_EXT)).string();
+					else
+						uri = (fs::path(path) / (sn + cf_ext)).string();
+					//the consistency check would read the meta data of every cytoframe
+					add_GatingHierarchy(GatingHierarchyPtr(new GatingHierarchy(ctx_, gh_pb, uri, is_skip_data, readonly)), sn, !ctx_.get_h5_lazy_load());
 
 				}
 			}
@@ -239,7 +277,20 @@ namespace cytolib
 						}
 
 					}
-					else if(ext == ".h5"||ext == ".pb")
+					else if(ext == H5_CONTAINER_EXT)
+					{
+						for(const auto & sn : list_h5_container(p.string()))
+						{
+							if(find(sn) == end())
+								throw(domain_error(errmsg + "cytoframe in h5 container not matched to any sample in GatingSet: " + sn));
+							cf_samples.insert(sn);
+						}
+					}
+					else if(ext == MMAP_META_EXT)
+					{
+						//the sidecar of the memory mapped cytoframe, which is validated along with its events file
+					}
+					else if(ext == ".h5"||ext == MMAP_EXT||ext == ".pb")
 					{
 						string sample_uid = p.stem().string();
 						if(find(sample_uid) == end())
@@ -333,7 +384,9 @@ namespace cytolib
 			auto src_uri = gh->get_cytoframe_view_ref().get_uri();
 			if(is_remote_path(path)||is_remote_path(src_uri))
 				PRINT("saving GatingHierarchy: " + sn + " \n");
-			string cf_filename = (fs::path(path) / sn).string();
+			string cf_filename = ctx.get_h5_container() ?
+					h5_container_uri((fs::path(path) / H5_CONTAINER_FILENAME).string(), sn)
+					: (fs::path(path) / sn).string();
 			string buf;
 			google::protobuf::io::StringOutputStream raw_output(&buf);
 
@@ -499,7 +552,9 @@ namespace cytolib
 
 			if(g_loglevel>=GATING_HIERARCHY_LEVEL)
 				PRINT("\n... copying GatingHierarchy: "+sn+"... \n");
-			gs.add_GatingHierarchy(gh->copy(is_copy_data, is_realize_data, (cf_dir/sn).string()), sn, is_copy_data);
+			string cf_filename = ctx_.get_h5_container() ?
+					h5_container_uri((cf_dir/H5_CONTAINER_FILENAME).string(), sn) : (cf_dir/sn).string();
+			gs.add_GatingHierarchy(gh->copy(is_copy_data, is_realize_data, cf_filename), sn, is_copy_data);
 
 		}
 
@@ -558,7 +613,25 @@ namespace cytolib
 					PRINT("\n... save flow data: "+sn+"... \n");
 				cfv.set_params(fr.get_params());
 				cfv.set_keywords(fr.get_keywords());
-				cfv.set_data(fr.get_data());
+				//only write back the columns modified by compensation and transformation
+				set<arma::uword> cols;
+				auto comp = gh->get_compensation();
+				if(comp.cid != "-2" && comp.cid != "")
+					for(const string & m : comp.marker)
+					{
+						int id = fr.get_col_idx(comp.prefix + m + comp.suffix, ColType::channel);
+						if(id >= 0)
+							cols.insert(id);
+					}
+				auto trans = gh->getLocalTrans();
+				for(const string & ch : fr.get_channels())
+				{
+					TransPtr curTrans = trans.getTran(ch);
+					if(curTrans && !curTrans->gateOnly())
+						cols.insert(fr.get_col_idx(ch, ColType::channel));
+				}
+				uvec col_idx(vector<arma::uword>(cols.begin(), cols.end()));
+				cfv.set_data(fr.get_data(col_idx, true), col_idx);
 			}
 			//attach to gh
 			gh->set_cytoframe_view(cfv);
@@ -727,6 +800,128 @@ namespace cytolib
 
 	}
 
+	void GatingSet::add_fcs(const vector<pair<string,string>> & sample_uid_vs_file_path
+			, const FCS_READ_PARAM & config, FileFormat fmt, string cf_dir
+			, bool readonly
+			, CytoCtx ctx)
+	{
+		if(!is_cytoFrame_only())
+			throw(domain_error("Can't add cytoframes to gs when it is not data-only object! "));
+		//the sample uids are checked before any file is parsed or written
+		unordered_set<string> uids;
+		for(const auto & it : sample_uid_vs_file_path)
+			if(find(it.first) != end() || !uids.insert(it.first).second)
+				throw(domain_error("Can't add new sample since it already exists for: " + it.first));
+
+		fs::path cf_path;
+		if(fmt!= FileFormat::MEM)
+			cf_path = generate_cytoframe_folder(cf_dir);
+
+		auto parse_fcs = [&config](const string & file_path){
+			CytoFramePtr fr_ptr(new MemCytoFrame(file_path,config));
+			//set pdata
+			fr_ptr->set_pheno_data("name", path_base_name(file_path));
+
+			dynamic_cast<MemCytoFrame&>(*fr_ptr).read_fcs();
+			return fr_ptr;
+		};
+		auto write_cytoframe = [&](const string & sample_uid, CytoFramePtr fr_ptr){
+			string cf_filename = (cf_path/sample_uid).string();
+			if(fmt == FileFormat::H5 && ctx.get_h5_container())
+			{
+				cf_filename = h5_container_uri((cf_path/H5_CONTAINER_FILENAME).string(), sample_uid);
+				write_h5_container(*fr_ptr, cf_filename, ctx.get_h5_write_param());
+				fr_ptr = load_cytoframe(cf_filename, readonly, ctx);
+			}
+			else if(fmt != FileFormat::MEM)
+			{
+				cf_filename += "." + fmt_to_str(fmt);
+				fr_ptr->write_to_disk(cf_filename, fmt, ctx);
+				fr_ptr = load_cytoframe(cf_filename, readonly, ctx);
+			}
+			return fr_ptr;
+		};
+
+		size_t nSample = sample_uid_vs_file_path.size();
+		size_t nWorker = min<size_t>(max(ctx.get_num_threads(), 1), nSample);
+		if(nWorker <= 1)
+		{
+			for(const auto & it : sample_uid_vs_file_path)
+				add_cytoframe_view(it.first, CytoFrameView(write_cytoframe(it.first, parse_fcs(it.second))));
+			return;
+		}
+
+		/*
+		 * parse stage: workers claim the next file and push the parsed frame into the queue,
+		 * blocking when the writer falls behind.
+		 * The messages of the parser are carried along with the frame and printed by the write stage
+		 */
+		struct ParsedFCS{
+			size_t idx;
+			CytoFramePtr fr_ptr;
+			string msg;
+		};
+		BoundedQueue<ParsedFCS> parsed(nWorker);
+		atomic<size_t> next_sample(0);
+		mutex err_mutex;
+		exception_ptr err;
+		auto on_error = [&](){
+			{
+				lock_guard<mutex> lock(err_mutex);
+				if(!err)
+					err = current_exception();
+			}
+			parsed.close();
+		};
+		vector<thread> workers;
+		for(size_t t = 0; t < nWorker; t++)
+			workers.emplace_back([&](){
+				try
+				{
+					size_t i;
+					while((i = next_sample++) < nSample)
+					{
+						PrintBuffer msg;
+						auto fr_ptr = parse_fcs(sample_uid_vs_file_path[i].second);
+						if(!parsed.push(ParsedFCS{i, fr_ptr, msg.str()}))
+							break;//the pipeline has been aborted
+					}
+				}
+				catch(...)
+				{
+					on_error();
+				}
+			});
+
+		/*
+		 * write stage: runs on the calling thread in the order the frames are parsed
+		 */
+		vector<CytoFramePtr> frames(nSample);
+		try
+		{
+			ParsedFCS item;
+			for(size_t k = 0; k < nSample && parsed.pop(item); k++)
+			{
+				if(!item.msg.empty())
+					PRINT(item.msg);
+				frames[item.idx] = write_cytoframe(sample_uid_vs_file_path[item.idx].first, item.fr_ptr);
+				item.fr_ptr.reset();//release the MemCytoFrame as soon as it is on disk
+			}
+		}
+		catch(...)
+		{
+			on_error();
+		}
+		parsed.close();
+		for(auto & w : workers)
+			w.join();
+		if(err)
+			rethrow_exception(err);
+
+		for(size_t i = 0; i < nSample; i++)
+			add_cytoframe_view(sample_uid_vs_file_path[i].first, CytoFrameView(frames[i]));
+	}
+
 	/**
 	 * update sample (move)
 	 * @param sample_uid
@@ -0,0 +1,164 @@
+// Copyright 2019 Fred Hutchinson Cancer Research Center
+// See the included LICENSE file for details on the licence that is granted to the user of this software.
+#include <cytolib/H5ContainerCytoFrame.hpp>
+
+namespace cytolib
+{
+	const string H5_CONTAINER_URI_SEP = "#";
+
+	static string h5_container_group(const string & sample_uid)
+	{
+		return H5_CONTAINER_GROUP + "/" + sample_uid;
+	}
+
+	string h5_container_uri(const string & container, const string & sample_uid)
+	{
+		return container + H5_CONTAINER_URI_SEP + sample_uid;
+	}
+
+	bool parse_h5_container_uri(const string & uri, string & container, string & sample_uid)
+	{
+		auto pos = uri.rfind(H5_CONTAINER_EXT + H5_CONTAINER_URI_SEP);
+		if(pos == string::npos)
+			return false;
+		pos += H5_CONTAINER_EXT.size();
+		container = uri.substr(0, pos);
+		sample_uid = uri.substr(pos + H5_CONTAINER_URI_SEP.size());
+		return !sample_uid.empty();
+	}
+
+	vector<string> list_h5_container(const string & container)
+	{
+		auto h5 = H5FileCache::instance().open(container, H5F_ACC_RDONLY);
+		Group samples = h5->file().openGroup(H5_CONTAINER_GROUP);
+		hsize_t n = samples.getNumObjs();
+		vector<string> res(n);
+		for(hsize_t i = 0; i < n; i++)
+			res[i] = samples.getObjnameByIdx(i);
+		return res;
+	}
+
+	bool has_h5_container_sample(const string & container, const string & sample_uid)
+	{
+		auto h5 = H5FileCache::instance().open(container, H5F_ACC_RDONLY);
+		return h5->file().exists(h5_container_group(sample_uid));
+	}
+
+	CytoFramePtr write_h5_container(const CytoFrame & fr, const string & uri, const H5_WRITE_PARAM & param)
+	{
+		string container, sample_uid;
+		if(!parse_h5_container_uri(uri, container, sample_uid))
+			throw(domain_error("Not a valid h5 container uri: " + uri));
+		check_sample_guid(sample_uid);
+		if(!fs::exists(container))
+		{
+			H5FileCache::instance().evict(container);
+			H5File file(container, H5F_ACC_EXCL, FileCreatPropList::DEFAULT, h5_create_plist(param));
+			file.createGroup(H5_CONTAINER_GROUP);
+		}
+		{
+			auto h5 = H5FileCache::instance().open(container, H5F_ACC_RDWR);
+			H5File & file = h5->file();
+			string group = h5_container_group(sample_uid);
+			if(file.exists(group))
+			{
+				h5->release_datasets(group);
+				file.unlink(group);
+			}
+			fr.write_h5_group(file.createGroup(group), param);
+			file.flush(H5F_SCOPE_LOCAL);
+		}
+		return CytoFramePtr(new H5ContainerCytoFrame(container, sample_uid, false));
+	}
+
+	void remove_h5_container_sample(const string & uri)
+	{
+		string container, sample_uid;
+		if(!parse_h5_container_uri(uri, container, sample_uid))
+			throw(domain_error("Not a valid h5 container uri: " + uri));
+		auto h5 = H5FileCache::instance().open(container, H5F_ACC_RDWR);
+		H5File & file = h5->file();
+		string group = h5_container_group(sample_uid);
+		if(file.exists(group))
+		{
+			h5->release_datasets(group);
+			file.unlink(group);
+			file.flush(H5F_SCOPE_LOCAL);
+		}
+	}
+
+	H5ContainerCytoFrame::H5ContainerCytoFrame(const string & container, const string & sample_uid, bool readonly, bool init)
+		:H5CytoFrame(container, readonly, false), sample_uid_(sample_uid)
+	{
+		group_ = h5_container_group(sample_uid);
+		if(init)
+			init_load();
+	}
+
+	CytoFramePtr H5ContainerCytoFrame::write_copy(const CytoFrame & fr, const string & cf_filename, bool overwrite) const
+	{
+		string container, sample_uid;
+		if(parse_h5_container_uri(cf_filename, container, sample_uid))
+		{
+			if(sample_uid == sample_uid_ && fs::exists(container) && fs::equivalent(container, filename_))
+			{
+				check_write_permission();
+				if(!overwrite)
+					throw(domain_error("Copying H5ContainerCytoFrame to itself is not supported! "+ cf_filename));
+			}
+			return write_h5_container(fr, cf_filename, get_h5_write_param());
+		}
+
+		string new_filename = cf_filename;
+		if(new_filename == "")
+		{
+			new_filename = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+			fs::remove(new_filename);
+		}
+		fr.write_h5(new_filename, get_h5_write_param());
+		return CytoFramePtr(new H5CytoFrame(new_filename, false));
+	}
+
+	CytoFramePtr H5ContainerCytoFrame::copy(const string & cf_filename, bool overwrite) const
+	{
+		//load it into memory first since the destination can be the sample itself
+		MemCytoFrame fr(*this);
+		return write_copy(fr, cf_filename, overwrite);
+	}
+
+	CytoFramePtr H5ContainerCytoFrame::copy(uvec idx, bool is_row_indexed, const string & cf_filename, bool overwrite) const
+	{
+		MemCytoFrame fr(*this);
+		return write_copy(*fr.copy(idx, is_row_indexed), cf_filename, overwrite);
+	}
+
+	CytoFramePtr H5ContainerCytoFrame::copy(uvec row_idx, uvec col_idx, const string & cf_filename, bool overwrite) const
+	{
+		MemCytoFrame fr(*this);
+		return write_copy(*fr.copy(row_idx, col_idx), cf_filename, overwrite);
+	}
+
+	void H5ContainerCytoFrame::convertToPb(pb::CytoFrame & fr_pb
+			, const string & cf_filename
+			, CytoFileOption h5_opt
+			, const CytoCtx &) const
+	{
+		fr_pb.set_is_h5(true);
+		if(h5_opt == CytoFileOption::skip)
+			return;
+		string container, sample_uid;
+		bool to_container = parse_h5_container_uri(cf_filename, container, sample_uid);
+		//archived to where it is
+		if(to_container && sample_uid == sample_uid_ && fs::exists(container) && fs::equivalent(container, filename_))
+			return;
+		if(h5_opt != CytoFileOption::copy && h5_opt != CytoFileOption::move)
+			throw(logic_error("Only 'copy' or 'move' option is supported for H5ContainerCytoFrame!"));
+		//the archive keeps the layout of the sample instead of the ctx one, the same as H5CytoFrame
+		if(to_container)
+			write_h5_container(*this, cf_filename, get_h5_write_param());
+		else
+			write_h5(cf_filename, get_h5_write_param());
+		if(h5_opt == CytoFileOption::move)
+			remove_h5_container_sample(get_uri());
+	}
+};
@@ -1,45 +1,227 @@
 // Copyright 2019 Fred Hutchinson Cancer Research Center
 // See the included LICENSE file for details on the licence that is granted to the user of this software.
 #include <cytolib/H5CytoFrame.hpp>
+#include <limits>
+#include <map>
 
 namespace cytolib
 {
-	EVENT_DATA_VEC H5CytoFrame::read_data(uvec col_idx) const
+	/**
+	 * split the sorted unique indices into the [begin, end) runs of consecutive values
+	 * @param max_gap the runs separated by no more than this many missing values are merged
+	 */
+	static vector<pair<hsize_t, hsize_t>> index_runs(const uvec & idx, hsize_t max_gap)
 	{
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
-		auto dataset = file.openDataSet(DATASET_NAME);
-		auto dataspace = dataset.getSpace();
+		vector<pair<hsize_t, hsize_t>> runs;
+		for(auto i : idx)
+		{
+			if(runs.size() > 0 && i <= runs.back().second + max_gap)
+				runs.back().second = i + 1;
+			else
+				runs.push_back(make_pair(i, i + 1));
+		}
+		return runs;
+	}
+	/**
+	 * @return true when the indices are strictly increasing, otherwise sort and dedup them into 'sorted'
+	 */
+	static bool sort_index(const uvec & idx, uvec & sorted)
+	{
+		for(unsigned i = 1; i < idx.size(); i++)
+			if(idx[i] <= idx[i - 1])
+			{
+				sorted = arma::unique(idx);//unique() also sorts
+				return false;
+			}
+		sorted = idx;
+		return true;
+	}
 
+	/**
+	 * read the entire columns by the direct chunk reads, which skip the selection and the type conversion of hdf5.
+	 * With the default layout (one chunk per column) and float events in memory, the chunks land in the result as they are.
+	 * @param disk_type the expected type of the events on disk, i.e. float of host byte order
+	 * @param dest the (nrow x ncol) col-major result
+	 * @return false when the dataset doesn't qualify (not chunked, filtered, different type or unallocated chunks),
+	 * 			then the caller falls back to the regular read
+	 */
+	static bool read_columns_direct(const DataSet & dataset, const DataType & disk_type
+			, const uvec & col_idx, hsize_t nrow, EVENT_DATA_TYPE * dest)
+	{
+#if !H5_VERSION_GE(1, 10, 3)
+		return false;//H5Dread_chunk is not available
+#else
+		DSetCreatPropList plist = dataset.getCreatePlist();
+		if(plist.getLayout() != H5D_CHUNKED || plist.getNfilters() > 0 || !(dataset.getDataType() == disk_type))
+			return false;
+		hsize_t chunk_dims[2];
+		plist.getChunk(2, chunk_dims);
+		hsize_t nchunk_col = chunk_dims[0], nchunk_row = chunk_dims[1];
+		hsize_t chunk_bytes = nchunk_col * nchunk_row * sizeof(float);
+		bool is_zero_copy = is_same<EVENT_DATA_TYPE, float>::value && nchunk_col == 1;
+		//the result columns grouped by the chunk column they fall in (in file order), so that each chunk is read once
+		map<hsize_t, vector<unsigned>> chunk_cols;
+		for(unsigned i = 0; i < col_idx.size(); i++)
+			chunk_cols[col_idx[i] - col_idx[i] % nchunk_col].push_back(i);
+		vector<float> buf;
+		for(const auto & it : chunk_cols)
+		{
+			const auto & cols = it.second;
+			for(hsize_t r = 0; r < nrow; r += nchunk_row)
+			{
+				hsize_t offset[2] = {it.first, r};
+				hsize_t nread = min(nchunk_row, nrow - r);
+				hsize_t storage_size = 0;
+				if(H5Dget_chunk_storage_size(dataset.getId(), offset, &storage_size) < 0 || storage_size != chunk_bytes)
+					return false;
+				uint32_t filter_mask = 0;
+				unsigned k = 0;//the first of the cols that is not filled yet
+				if(is_zero_copy && nread == nchunk_row)
+				{
+					//all the cols are the same column (duplicated request), which are copied from the first one
+					if(H5Dread_chunk(dataset.getId(), H5P_DEFAULT, offset, &filter_mask, dest + cols[0] * nrow + r) < 0)
+						return false;
+					k = 1;
+				}
+				else
+				{
+					buf.resize(nchunk_col * nchunk_row);
+					if(H5Dread_chunk(dataset.getId(), H5P_DEFAULT, offset, &filter_mask, buf.data()) < 0)
+						return false;
+				}
+				for(; k < cols.size(); k++)
+				{
+					unsigned i = cols[k];
+					EVENT_DATA_TYPE * dst = dest + i * nrow + r;
+					if(is_zero_copy && nread == nchunk_row)
+						copy(dest + cols[0] * nrow + r, dest + cols[0] * nrow + r + nread, dst);
+					else
+					{
+						//the chunk is a (nchunk_col x nchunk_row) row-major block, so each column is contiguous
+						const float * src = buf.data() + (col_idx[i] % nchunk_col) * nchunk_row;
+						for(hsize_t j = 0; j < nread; j++)
+							dst[j] = src[j];
+					}
+				}
+			}
+		}
+		return true;
+#endif
+	}
+
+	EVENT_DATA_VEC H5CytoFrame::read_data(uvec col_idx, uvec row_idx, bool is_row_indexed) const
+	{
 		unsigned nrow = n_rows();
 		unsigned ncol = col_idx.size();
+		unsigned nsel = is_row_indexed ? row_idx.size() : nrow;
+		if(nsel == 0 || ncol == 0)
+			return EVENT_DATA_VEC(nsel, ncol);
+		if(is_row_indexed && row_idx.max() >= nrow)
+			throw(domain_error("row index out of bound: " + to_string(row_idx.max())));
+
 		/*
-		 * Define the memory dataspace.
+		 * h5 visits the selected elements in file order, so the rows and columns are read in ascending order
+		 * and only rearranged afterwards when the request is not already sorted or has duplicates
 		 */
-		hsize_t dimsm[] = {ncol, nrow};
+		uvec file_cols, file_rows;
+		bool is_col_sorted = sort_index(col_idx, file_cols);
+		auto col_runs = index_runs(file_cols, 0);
+		vector<pair<hsize_t, hsize_t>> row_runs;
+		bool is_row_sorted = true;
+		if(is_row_indexed)
+		{
+			is_row_sorted = sort_index(row_idx, file_rows);
+			//the dense rows are read as ranges, the few unwanted rows in between are cheaper than the extra selection blocks
+			row_runs = index_runs(file_rows, H5_ROW_COALESCE_GAP);
+		}
+		else
+			row_runs.push_back(make_pair(0, nrow));
+
+		auto h5 = open_h5();
+		auto dataset = h5->dataset(h5_path(DATASET_NAME));
+		if(!is_row_indexed && !swmr_ && cache_param_.direct_chunk_read)
+		{
+			EVENT_DATA_VEC data(nrow, ncol);
+			if(read_columns_direct(dataset, h5_datatype_data(DataTypeLocation::H5), col_idx, nrow, data.memptr()))
+				return data;
+		}
+		auto dataspace = dataset.getSpace();
+
+		bool is_point = false;
+		if(row_runs.size() * col_runs.size() > H5_MAX_SELECTION_BLOCKS)
+		{
+			hsize_t span = row_runs.back().second - row_runs.front().first;
+			if(file_rows.size() * H5_ROW_SPAN_DENSITY >= span)
+				row_runs = {make_pair(row_runs.front().first, row_runs.back().second)};
+			else
+			{
+				row_runs = index_runs(file_rows, 0);
+				is_point = true;
+			}
+		}
+		hsize_t nread_row = 0;
+		for(const auto & r : row_runs)
+			nread_row += r.second - r.first;
+		hsize_t nread_col = file_cols.size();
+		if(is_point)
+		{
+			//the points are listed in the order of the buffer below
+			vector<hsize_t> coord;
+			coord.reserve(2 * nread_col * nread_row);
+			for(auto c : file_cols)
+				for(auto r : file_rows)
+				{
+					coord.push_back(c);
+					coord.push_back(r);
+				}
+			dataspace.selectElements(H5S_SELECT_SET, nread_col * nread_row, coord.data());
+		}
+		else
+		{
+			/*
+			 * select the union of the column runs x row runs so that everything is read by a single call,
+			 * e.g. the entire matrix or any consecutive channels end up with one hyperslab
+			 */
+			dataspace.selectNone();
+			for(const auto & c : col_runs)
+				for(const auto & r : row_runs)
+				{
+					hsize_t      offset[] = {c.first, r.first};   // hyperslab offset in the file
+					hsize_t      count[] = {c.second - c.first, r.second - r.first};    // size of the hyperslab in the file
+					dataspace.selectHyperslab( H5S_SELECT_OR, count, offset );
+				}
+		}
+		//the memory is laid out as the (nread_col x nread_row) row-major array which matches the selection in whole
+		hsize_t dimsm[] = {nread_col, nread_row};
 		DataSpace memspace(2,dimsm);
-		hsize_t      offset_mem[2];
-		hsize_t      count_mem[2];
-		EVENT_DATA_VEC data(nrow, ncol);
-		//reach one col at a time
+		EVENT_DATA_VEC data(nread_row, nread_col);
+		dataset.read(data.memptr(), h5_datatype_data(DataTypeLocation::MEM) ,memspace, dataspace);
+
+		bool is_row_exact = is_row_sorted && nread_row == nsel;
+		if(is_col_sorted && is_row_exact)
+			return data;
+
+		//locate the requested rows and columns within the buffer
+		uvec buf_cols(ncol);
 		for(unsigned i = 0; i < ncol; i++)
+			buf_cols[i] = lower_bound(file_cols.begin(), file_cols.end(), col_idx[i]) - file_cols.begin();
+		if(is_row_exact)
+			return data.cols(buf_cols);
+
+		vector<hsize_t> run_offset(row_runs.size(), 0);//the position of each row run within the buffer
+		for(unsigned k = 1; k < row_runs.size(); k++)
+			run_offset[k] = run_offset[k - 1] + row_runs[k - 1].second - row_runs[k - 1].first;
+		uvec buf_rows(nsel);
+		for(unsigned i = 0; i < nsel; i++)
 		{
-			//select slab for h5 data space
-			unsigned idx = col_idx[i];
-			hsize_t      offset[] = {idx, 0};   // hyperslab offset in the file
-			hsize_t      count[] = {1, nrow};    // size of the hyperslab in the file
-			dataspace.selectHyperslab( H5S_SELECT_SET, count, offset );
-
-			//select slab for mem
-			offset_mem[0] = i;
-			offset_mem[1] = 0;
-			count_mem[0]  = 1;
-			count_mem[1]  = nrow;
-			memspace.selectHyperslab( H5S_SELECT_SET, count_mem, offset_mem );
-
-			dataset.read(data.memptr(), h5_datatype_data(DataTypeLocation::MEM) ,memspace, dataspace);
+			hsize_t r = row_idx[i];
+			auto it = upper_bound(row_runs.begin(), row_runs.end(), make_pair(r, numeric_limits<hsize_t>::max())) - 1;
+			buf_rows[i] = run_offset[it - row_runs.begin()] + r - it->first;
 		}
-
-		return data;
+		if(is_col_sorted)
+			return data.rows(buf_rows);
+		else
+			return data.submat(buf_rows, buf_cols);
 	}
 
 
@@ -64,10 +246,11 @@ namespace cytolib
 	void H5CytoFrame::flush_params()
 	{
 		check_write_permission();
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
+		ensure_meta_loaded();
+		auto h5 = open_h5();
 
 		CompType param_type = get_h5_datatype_params(DataTypeLocation::MEM);
-		DataSet ds = file.openDataSet("params");
+		DataSet ds = h5->dataset(h5_path("params"));
 		hsize_t size[1] = {params.size()};
 		ds.extend(size);
 		auto params_char = params_c_str();
@@ -80,9 +263,10 @@ namespace cytolib
 	void H5CytoFrame::flush_keys()
 	{
 		check_write_permission();
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
+		ensure_meta_loaded();
+		auto h5 = open_h5();
 		CompType key_type = get_h5_datatype_keys();
-		DataSet ds = file.openDataSet("keywords");
+		DataSet ds = h5->dataset(h5_path("keywords"));
 		auto keyVec = to_kw_vec<KEY_WORDS>(keys_);
 
 		hsize_t size[1] = {keyVec.size()};
@@ -95,9 +279,10 @@ namespace cytolib
 	void H5CytoFrame::flush_pheno_data()
 	{
 		check_write_permission();
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
+		ensure_meta_loaded();
+		auto h5 = open_h5();
 		CompType key_type = get_h5_datatype_keys();
-		DataSet ds = file.openDataSet("pdata");
+		DataSet ds = h5->dataset(h5_path("pdata"));
 
 		auto keyVec = to_kw_vec<PDATA>(pheno_data_);
 		hsize_t size[1] = {keyVec.size()};
@@ -115,8 +300,14 @@ namespace cytolib
 	 * abandon the changes to the meta data in cache by reloading them from disk
 	 */
 	void H5CytoFrame::load_meta(){
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
-		DataSet ds_param = file.openDataSet("params");
+		//the lazy frame loads everything at once
+		if(!is_loaded_)
+		{
+			init_load();
+			return;
+		}
+		auto h5 = open_h5();
+		DataSet ds_param = h5->dataset(h5_path("params"));
 	//	DataType param_type = ds_param.getDataType();
 
 		hsize_t dim_param[1];
@@ -188,7 +379,7 @@ namespace cytolib
 		key_type.insertMember("value", HOFFSET(key_t, value), str_type);
 
 
-		DataSet ds_key = file.openDataSet( "keywords");
+		DataSet ds_key = h5->dataset(h5_path("keywords"));
 		DataSpace dsp_key = ds_key.getSpace();
 		hsize_t dim_key[1];
 		dsp_key.getSimpleExtentDims(dim_key);
@@ -212,7 +403,7 @@ namespace cytolib
 		 *
 		 * read pdata
 		 */
-		DataSet ds_pd = file.openDataSet( "pdata");
+		DataSet ds_pd = h5->dataset(h5_path("pdata"));
 		DataSpace dsp_pd = ds_pd.getSpace();
 		hsize_t dim_pd[1];
 		dsp_pd.getSimpleExtentDims(dim_pd);
@@ -234,21 +425,147 @@ namespace cytolib
 
 
 
+	void H5CytoFrame::set_data(const EVENT_DATA_VEC & data_in, uvec col_idx)
+	{
+		check_write_permission();
+		check_set_data_cols(data_in, col_idx);
+		if(data_in.n_elem == 0)
+			return;
+
+		//h5 visits the selected elements in file order, so the input columns are sorted the same way
+		uvec file_cols;
+		const EVENT_DATA_VEC * data = &data_in;
+		EVENT_DATA_VEC sorted_data;
+		if(!sort_index(col_idx, file_cols))
+		{
+			uvec order = arma::sort_index(col_idx);
+			sorted_data = data_in.cols(order);
+			data = &sorted_data;
+		}
+
+		auto h5 = open_h5();
+		auto dataset = h5->dataset(h5_path(DATASET_NAME));
+		DataSpace filespace = dataset.getSpace();
+		filespace.selectNone();
+		for(const auto & c : index_runs(file_cols, 0))
+		{
+			hsize_t offset[2] = {c.first, 0};
+			hsize_t count[2] = {c.second - c.first, dims[1]};
+			filespace.selectHyperslab(H5S_SELECT_OR, count, offset);
+		}
+		hsize_t dimsm[2] = {file_cols.size(), dims[1]};
+		DataSpace memspace(2, dimsm);
+		dataset.write(data->memptr(), h5_datatype_data(DataTypeLocation::MEM), memspace, filespace);
+		dataset.flush(H5F_SCOPE_LOCAL);
+	}
+
+	void H5CytoFrame::append_data_columns(const EVENT_DATA_VEC & new_cols)
+	{
+		check_write_permission();
+		ensure_meta_loaded();
+		if(new_cols.n_rows != dims[1])
+			throw(domain_error("New columns must have same number of rows as existing columns."));
+		auto h5 = open_h5();
+		auto dataset = h5->dataset(h5_path(DATASET_NAME));
+
+		//the dataset is created with unlimited max dims, so it can grow without touching the existing columns
+		hsize_t new_dims[2] = {dims[0] + new_cols.n_cols, dims[1]};
+		dataset.extend(new_dims);
+		if(new_cols.n_elem > 0)
+		{
+			//col-major matrix is laid out the same as a (ncol x nrow) row-major array, which matches the dataset
+			hsize_t offset[2] = {dims[0], 0};
+			hsize_t count[2] = {new_cols.n_cols, new_cols.n_rows};
+			DataSpace filespace = dataset.getSpace();
+			filespace.selectHyperslab(H5S_SELECT_SET, count, offset);
+			DataSpace memspace(2, count);
+			dataset.write(new_cols.memptr(), h5_datatype_data(DataTypeLocation::MEM), memspace, filespace);
+		}
+		dataset.flush(H5F_SCOPE_LOCAL);
+		dims[0] = new_dims[0];
+	}
+
+	void H5CytoFrame::append_rows(const EVENT_DATA_VEC & new_rows, const vector<string> & new_rownames)
+	{
+		check_write_permission();
+		ensure_meta_loaded();
+		if(new_rows.n_cols != dims[0])
+			throw(domain_error("New rows must have same number of columns as existing rows."));
+		auto h5 = open_h5();
+		H5File & file = h5->file();
+		Group group = h5_group(*h5);
+		bool has_rownames = RowNames::exists_h5(group);
+		if(has_rownames)
+		{
+			//the rownames may need to be encoded differently (i.e. new datasets), which SWMR writer can't do
+			if(swmr_ && new_rows.n_rows > 0)
+				throw(domain_error("Can't append rows to the cytoframe with rownames in SWMR mode!"));
+			if(new_rownames.size() != new_rows.n_rows)
+				throw(domain_error("The number of new rownames is different from the number of new rows!"));
+		}
+		else if(new_rownames.size() > 0)
+			throw(domain_error("Can't append rownames to the cytoframe that has no rownames!"));
+
+		auto dataset = h5->dataset(h5_path(DATASET_NAME));
+		hsize_t new_dims[2] = {dims[0], dims[1] + new_rows.n_rows};
+		dataset.extend(new_dims);
+		try
+		{
+			if(new_rows.n_elem > 0)
+			{
+				//col-major block is laid out the same as a (ncol x nrow) row-major array, which matches the dataset
+				hsize_t offset[2] = {0, dims[1]};
+				hsize_t count[2] = {new_rows.n_cols, new_rows.n_rows};
+				DataSpace filespace = dataset.getSpace();
+				filespace.selectHyperslab(H5S_SELECT_SET, count, offset);
+				DataSpace memspace(2, count);
+				dataset.write(new_rows.memptr(), h5_datatype_data(DataTypeLocation::MEM), memspace, filespace);
+			}
+			if(has_rownames && new_rownames.size() > 0)
+			{
+				//each of the stored forms is extended, the legacy strings are left in their format
+				RowNames(new_rownames).append_h5(group);
+			}
+		}
+		catch(...)
+		{
+			//shrink it back so that the events never outnumber the rownames
+			hsize_t old_dims[2] = {dims[0], dims[1]};
+			dataset.extend(old_dims);
+			throw;
+		}
+		dataset.flush(H5F_SCOPE_LOCAL);
+		if(has_rownames && new_rownames.size() > 0)
+			file.flush(H5F_SCOPE_LOCAL);
+		dims[1] = new_dims[1];
+	}
+
+	void H5CytoFrame::refresh()
+	{
+		ensure_meta_loaded();
+		auto h5 = open_h5();
+		auto dataset = h5->dataset(h5_path(DATASET_NAME));
+		if(swmr_ && readonly_ && H5Drefresh(dataset.getId()) < 0)
+			throw(domain_error("Failed to refresh the events of " + filename_));
+		dataset.getSpace().getSimpleExtentDims(dims);
+	}
+
 	/**
 	 * copy setter
 	 * @param _data
 	 */
 	void H5CytoFrame::set_data(const EVENT_DATA_VEC & _data)
 	{
-		H5File file(filename_, h5_flags(), FileCreatPropList::DEFAULT, access_plist_);
 		check_write_permission();
+		ensure_meta_loaded();
+		auto h5 = open_h5();
 		hsize_t dims_data[2] = {_data.n_cols, _data.n_rows};
 
 		// For the case that the data matrix has been re-sized
 		dims[0] = _data.n_cols;
 		dims[1] = _data.n_rows;
 
-		auto dataset = file.openDataSet(DATASET_NAME);
+		auto dataset = h5->dataset(h5_path(DATASET_NAME));
 
 		dataset.extend(dims_data);
 		//refresh data space and dims
@@ -0,0 +1,241 @@
+// Copyright 2019 Fred Hutchinson Cancer Research Center
+// See the included LICENSE file for details on the licence that is granted to the user of this software.
+#include <cytolib/H5FileCache.hpp>
+#include <boost/filesystem.hpp>
+#include <stdexcept>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+namespace fs = boost::filesystem;
+
+namespace cytolib
+{
+	static FileAccPropList cached_access_plist(const FileAccPropList & access_plist, unsigned flags, const H5_CACHE_PARAM & cache_param)
+	{
+		//copy it so that the caller's fapl (e.g. s3 settings) stays untouched
+		FileAccPropList fapl;
+		fapl.copy(access_plist);
+		fapl.setCache(0, cache_param.rdcc_nslots, cache_param.rdcc_nbytes, cache_param.rdcc_w0);
+		//SWMR writer requires the latest file format
+		if(flags & H5F_ACC_SWMR_WRITE)
+			fapl.setLibverBounds(H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+		return fapl;
+	}
+	H5FileHandle::H5FileHandle(const string & filename, unsigned flags, const FileAccPropList & access_plist
+			, const H5_CACHE_PARAM & cache_param)
+		:file_(filename, flags, FileCreatPropList::DEFAULT, cached_access_plist(access_plist, flags, cache_param))
+	{
+		dataset_plist_.setChunkCache(cache_param.rdcc_nslots, cache_param.rdcc_nbytes, cache_param.rdcc_w0);
+		//the external raw data (e.g. the events of MappedCytoFrame) is located next to the h5 file instead of the working directory
+		H5Pset_efile_prefix(dataset_plist_.getId(), "${ORIGIN}");
+#if defined(POSIX_FADV_NORMAL) || defined(F_RDAHEAD)
+		if(cache_param.read_ahead != H5ReadAhead::normal)
+		{
+			//only the posix drivers (sec2, the default) expose the file descriptor, others (e.g. ros3) are left alone
+			try
+			{
+				void * vfd = nullptr;
+				file_.getVFDHandle(&vfd);
+				if(vfd && file_.getAccessPlist().getDriver() == H5FD_SEC2)
+				{
+					int fd = *static_cast<int *>(vfd);
+#if defined(POSIX_FADV_NORMAL)
+					int advice = POSIX_FADV_NORMAL;
+					switch(cache_param.read_ahead)
+					{
+					case H5ReadAhead::sequential:
+						advice = POSIX_FADV_SEQUENTIAL;
+						break;
+					case H5ReadAhead::random:
+						advice = POSIX_FADV_RANDOM;
+						break;
+					case H5ReadAhead::prefetch:
+						advice = POSIX_FADV_WILLNEED;
+						break;
+					default:
+						break;
+					}
+					posix_fadvise(fd, 0, 0, advice);
+#else
+					//macOS has no fadvise, only the read-ahead can be turned off for the random access
+					fcntl(fd, F_RDAHEAD, cache_param.read_ahead == H5ReadAhead::random ? 0 : 1);
+#endif
+				}
+			}
+			catch(const Exception &)
+			{
+			}
+		}
+#endif
+	}
+	DataSet H5FileHandle::dataset(const string & name)
+	{
+		lock_guard<mutex> lock(mutex_);
+		auto it = datasets_.find(name);
+		if(it == datasets_.end())
+			it = datasets_.emplace(name, file_.openDataSet(name, dataset_plist_)).first;
+		return it->second;
+	}
+
+	void H5FileHandle::release_datasets(const string & group)
+	{
+		lock_guard<mutex> lock(mutex_);
+		string prefix = group + "/";
+		for(auto it = datasets_.begin(); it != datasets_.end();)
+		{
+			if(it->first.compare(0, prefix.size(), prefix) == 0)
+				it = datasets_.erase(it);
+			else
+				++it;
+		}
+	}
+
+	H5FileStamp H5FileStamp::of(const string & filename)
+	{
+		H5FileStamp stamp;
+#ifndef _WIN32
+		struct stat st;
+		if(stat(filename.c_str(), &st) == 0)
+		{
+#ifdef __APPLE__
+			const struct timespec & t = st.st_mtimespec;
+#else
+			const struct timespec & t = st.st_mtim;
+#endif
+			stamp.dev = st.st_dev;
+			stamp.ino = st.st_ino;
+			stamp.size = st.st_size;
+			stamp.mtime = static_cast<int64_t>(t.tv_sec) * 1000000000 + t.tv_nsec;
+			stamp.valid = true;
+		}
+#else
+		boost::system::error_code ec;
+		stamp.size = fs::file_size(filename, ec);
+		if(!ec)
+		{
+			stamp.mtime = static_cast<int64_t>(fs::last_write_time(filename, ec)) * 1000000000;
+			stamp.valid = !ec;
+		}
+#endif
+		return stamp;
+	}
+
+	/**
+	 * the same file reached through the different paths (e.g. symlink) shares the entry,
+	 * the path that can't be resolved (e.g. remote file) is used as is
+	 */
+	static string cache_key(const string & filename)
+	{
+		boost::system::error_code ec;
+		auto p = fs::canonical(filename, ec);
+		return ec ? filename : p.string();
+	}
+
+	H5FileCache & H5FileCache::instance()
+	{
+		static H5FileCache cache;
+		return cache;
+	}
+
+	void H5FileCache::erase(const string & filename)
+	{
+		auto it = index_.find(filename);
+		if(it != index_.end())
+		{
+			lru_.erase(it->second);
+			index_.erase(it);
+		}
+	}
+
+	void H5FileCache::trim()
+	{
+		while(lru_.size() > capacity_)
+		{
+			index_.erase(lru_.back().filename);
+			lru_.pop_back();
+		}
+	}
+
+	H5FileHandlePtr H5FileCache::open(const string & filename, unsigned flags, const FileAccPropList & access_plist
+			, const H5_CACHE_PARAM & cache_param)
+	{
+		string key = cache_key(filename);
+		H5FileStamp stamp = H5FileStamp::of(filename);
+		lock_guard<mutex> lock(mutex_);
+		auto it = index_.find(key);
+		if(it != index_.end())
+		{
+			auto entry = it->second;
+			bool serves = entry->flags == flags || (!(flags & H5F_ACC_RDWR) && (entry->flags & H5F_ACC_RDWR));
+			//changed by the other processes, see the class doc
+			bool is_changed = (entry->flags & (H5F_ACC_RDWR | H5F_ACC_SWMR_READ)) ? entry->stamp.is_replaced_by(stamp) : entry->stamp.is_modified_by(stamp);
+			if(serves && entry->cache_param == cache_param && !is_changed)
+			{
+				lru_.splice(lru_.begin(), lru_, entry);
+				return entry->handle;
+			}
+			if(!serves && !entry->stamp.is_replaced_by(stamp) && entry->handle.use_count() > 1)
+				throw(domain_error("Can't open the h5 file in the different mode while it is still in use: " + filename));
+			//cached as read-only, with different cache settings or stale, have to close it before reopening
+			erase(key);
+		}
+
+		H5FileHandlePtr handle(new H5FileHandle(filename, flags, access_plist, cache_param));
+		if(capacity_ > 0)
+		{
+			lru_.push_front(Entry{key, flags, cache_param, handle, stamp});
+			index_[key] = lru_.begin();
+			trim();
+		}
+		return handle;
+	}
+
+	void H5FileCache::evict(const string & filename)
+	{
+		string key = cache_key(filename);
+		lock_guard<mutex> lock(mutex_);
+		erase(key);
+		//the file is already gone, so its path can't be resolved anymore
+		if(key == filename)
+			erase(fs::absolute(filename).string());
+	}
+
+	void H5FileCache::clear()
+	{
+		lock_guard<mutex> lock(mutex_);
+		lru_.clear();
+		index_.clear();
+	}
+
+	void H5FileCache::set_capacity(size_t n)
+	{
+		lock_guard<mutex> lock(mutex_);
+		capacity_ = n;
+		trim();
+	}
+
+	size_t H5FileCache::get_capacity() const
+	{
+		lock_guard<mutex> lock(mutex_);
+		return capacity_;
+	}
+
+	void H5FileCache::set_default_cache_param(const H5_CACHE_PARAM & param)
+	{
+		lock_guard<mutex> lock(mutex_);
+		default_cache_param_ = param;
+	}
+
+	H5_CACHE_PARAM H5FileCache::get_default_cache_param() const
+	{
+		lock_guard<mutex> lock(mutex_);
+		return default_cache_param_;
+	}
+
+	size_t H5FileCache::size() const
+	{
+		lock_guard<mutex> lock(mutex_);
+		return lru_.size();
+	}
+};
@@ -0,0 +1,290 @@
+// Copyright 2019 Fred Hutchinson Cancer Research Center
+// See the included LICENSE file for details on the licence that is granted to the user of this software.
+#include <cytolib/MappedCytoFrame.hpp>
+#include <cytolib/H5CytoFrame.hpp>
+#include <fstream>
+
+namespace cytolib
+{
+	/**
+	 * (re)create the events dataset of the sidecar, which holds no data but points to the events file
+	 */
+	static void write_mmap_events_ref(H5File & file, const string & filename, const DataType & dtype, hsize_t nrow, hsize_t ncol)
+	{
+		if(file.exists(DATASET_NAME))
+			file.unlink(DATASET_NAME);
+		hsize_t dims[2] = {ncol, nrow};
+		DataSpace dataspace(2, dims);
+		DSetCreatPropList plist;
+		hsize_t nbytes = nrow * ncol * sizeof(EVENT_DATA_TYPE);
+		//the relative path is resolved against the sidecar (see H5FileHandle)
+		if(nbytes > 0)
+			plist.setExternal(fs::path(filename).filename().string().c_str(), 0, nbytes);
+		file.createDataSet(DATASET_NAME, dtype, dataspace, plist);
+	}
+
+	/**
+	 * write the events as one col-major block.
+	 * It goes to a temporary file that then replaces the old one, so that the frames (possibly of the other processes)
+	 * still mapping the old file keep reading the old events instead of the partially written ones
+	 */
+	static void write_mmap_events(const EVENT_DATA_VEC & dat, const string & filename)
+	{
+		string tmp = filename + ".tmp";
+		{
+			ofstream out(tmp, ios::out | ios::binary | ios::trunc);
+			if(!out)
+				throw(domain_error("can't write the events file: " + tmp));
+			out.write(reinterpret_cast<const char *>(dat.memptr()), dat.n_elem * sizeof(EVENT_DATA_TYPE));
+			if(!out)
+				throw(domain_error("failed to write the events file: " + tmp));
+		}
+		fs::rename(tmp, filename);
+	}
+
+	static void write_mmap_meta(const CytoFrame & fr, const string & filename, hsize_t nrow, hsize_t ncol)
+	{
+		string meta = mmap_meta_path(filename);
+		string tmp = meta + ".tmp";
+		{
+			H5File file(tmp, H5F_ACC_TRUNC);
+			fr.write_h5_params(file);
+			fr.write_h5_keys(file);
+			fr.write_h5_pheno_data(file);
+			write_mmap_events_ref(file, filename, fr.h5_datatype_data(DataTypeLocation::MEM), nrow, ncol);
+			fr.write_h5_rownames(file, fr.get_compact_rownames());
+		}
+		H5FileCache::instance().evict(meta);
+		fs::rename(tmp, meta);
+	}
+
+	void write_mmap(const CytoFrame & fr, const string & filename)
+	{
+		//the in-memory events are written as they are
+		EVENT_DATA_VEC dat;
+		auto mem = dynamic_cast<const MemCytoFrame *>(&fr);
+		const EVENT_DATA_VEC & events = mem ? mem->get_data_ref() : (dat = fr.get_data());
+		write_mmap_events(events, filename);
+		write_mmap_meta(fr, filename, events.n_rows, events.n_cols);
+	}
+
+	MappedCytoFrame::MappedCytoFrame(const string & filename, bool readonly):uri_(filename), readonly_(readonly)
+	{
+		if(!fs::exists(uri_))
+			throw(domain_error("events file not found: " + uri_));
+		string meta = mmap_meta_path(uri_);
+		if(!fs::exists(meta))
+			throw(domain_error("meta data file not found: " + meta));
+		load_meta();
+		auto & cache = H5FileCache::instance();
+		auto h5 = cache.open(meta, H5F_ACC_RDONLY, FileAccPropList::DEFAULT, cache.get_default_cache_param());
+		auto dataset = h5->dataset(DATASET_NAME);
+		hsize_t dims[2];
+		dataset.getSpace().getSimpleExtentDims(dims);
+		if(dataset.getDataType() == h5_datatype_data(DataTypeLocation::MEM))
+			map_events(dims[1], dims[0]);
+		else//written with the other events precision, let h5 convert it
+			data_ = H5CytoFrame(meta, true).get_data();
+	}
+
+	MappedCytoFrame::MappedCytoFrame(const MappedCytoFrame & frm):MemCytoFrame()
+	{
+		*this = frm;
+	}
+
+	MappedCytoFrame::MappedCytoFrame(MappedCytoFrame && frm):MemCytoFrame(std::move(frm))
+	{
+		swap(uri_, frm.uri_);
+		swap(readonly_, frm.readonly_);
+		swap(mapped_, frm.mapped_);
+	}
+
+	MappedCytoFrame & MappedCytoFrame::operator=(const MappedCytoFrame & frm)
+	{
+		if(this == &frm)
+			return *this;
+		CytoFrame::operator=(frm);
+		rownames_ = frm.rownames_;
+		uri_ = frm.uri_;
+		readonly_ = frm.readonly_;
+		//detach from the current mapping before it is released
+		data_.reset();
+		if(frm.is_mapped())
+		{
+			EVENT_DATA_VEC view(const_cast<EVENT_DATA_TYPE *>(frm.data_.memptr()), frm.data_.n_rows, frm.data_.n_cols, false, false);
+			data_.steal_mem(view);
+		}
+		else
+			data_ = frm.data_;
+		mapped_ = frm.mapped_;
+		return *this;
+	}
+
+	MappedCytoFrame & MappedCytoFrame::operator=(MappedCytoFrame && frm)
+	{
+		MemCytoFrame::operator=(std::move(frm));
+		swap(uri_, frm.uri_);
+		swap(readonly_, frm.readonly_);
+		swap(mapped_, frm.mapped_);
+		return *this;
+	}
+
+	void MappedCytoFrame::map_events(hsize_t nrow, hsize_t ncol)
+	{
+		size_t nbytes = nrow * ncol * sizeof(EVENT_DATA_TYPE);
+		EVENT_DATA_VEC events(nrow, ncol);
+		shared_ptr<MappedFile> mapped;
+		if(nbytes > 0)
+		{
+			if(MappedFile::is_supported())
+			{
+				mapped.reset(new MappedFile(uri_, 0, nbytes, true));
+				if(mapped->size() < nbytes)
+					throw(domain_error("the events file is truncated: " + uri_));
+				EVENT_DATA_VEC view(reinterpret_cast<EVENT_DATA_TYPE *>(mapped->data()), nrow, ncol, false, false);
+				events.steal_mem(view);
+			}
+			else
+			{
+				ifstream in(uri_, ios::in | ios::binary);
+				in.read(reinterpret_cast<char *>(events.memptr()), nbytes);
+				if(!in)
+					throw(domain_error("the events file is truncated: " + uri_));
+			}
+		}
+		//let go of the old mapping only after data_ no longer refers to it
+		data_.reset();
+		data_.steal_mem(events);
+		mapped_ = mapped;
+	}
+
+	void MappedCytoFrame::flush_meta()
+	{
+		check_write_permission();
+		write_mmap_meta(*this, uri_, data_.n_rows, data_.n_cols);
+	}
+
+	void MappedCytoFrame::load_meta()
+	{
+		H5CytoFrame meta(mmap_meta_path(uri_), true);
+		CytoFrame::operator=(meta);
+		rownames_ = meta.get_compact_rownames();
+	}
+
+	void MappedCytoFrame::set_data(const EVENT_DATA_VEC & _data)
+	{
+		check_write_permission();
+		write_mmap_events(_data, uri_);
+		string meta = mmap_meta_path(uri_);
+		H5FileCache::instance().evict(meta);
+		{
+			H5File file(meta, H5F_ACC_RDWR);
+			write_mmap_events_ref(file, uri_, h5_datatype_data(DataTypeLocation::MEM), _data.n_rows, _data.n_cols);
+		}
+		map_events(_data.n_rows, _data.n_cols);
+	}
+
+	void MappedCytoFrame::set_data(const EVENT_DATA_VEC & data_in, uvec col_idx)
+	{
+		check_write_permission();
+		check_set_data_cols(data_in, col_idx);
+		EVENT_DATA_VEC dat = data_;
+		dat.cols(col_idx) = data_in;
+		set_data(dat);
+	}
+
+	void MappedCytoFrame::append_data_columns(const EVENT_DATA_VEC & new_cols)
+	{
+		check_write_permission();
+		set_data(EVENT_DATA_VEC(join_rows(data_, new_cols)));
+	}
+
+	CytoFramePtr MappedCytoFrame::write_copy(const CytoFrame & fr, const string & cf_filename, bool overwrite) const
+	{
+		if(is_h5_container_uri(cf_filename))
+			return write_h5_container(fr, cf_filename);
+		string new_filename = cf_filename;
+		if(new_filename == "")
+		{
+			new_filename = generate_unique_filename(fs::temp_directory_path().string(), "", MMAP_EXT);
+			fs::remove(new_filename);
+		}
+		else if(fs::exists(new_filename) && fs::equivalent(new_filename, uri_))
+		{
+			check_write_permission();
+			if(!overwrite)
+				throw(domain_error("Copying MappedCytoFrame to itself is not supported! "+ cf_filename));
+		}
+		//the frames mapping the old file are not affected since it is replaced instead of overwritten
+		write_mmap(fr, new_filename);
+		return CytoFramePtr(new MappedCytoFrame(new_filename, false));
+	}
+
+	CytoFramePtr MappedCytoFrame::copy(const string & cf_filename, bool overwrite) const
+	{
+		return write_copy(*this, cf_filename, overwrite);
+	}
+
+	CytoFramePtr MappedCytoFrame::copy(uvec idx, bool is_row_indexed, const string & cf_filename, bool overwrite) const
+	{
+		return write_copy(*MemCytoFrame::copy(idx, is_row_indexed), cf_filename, overwrite);
+	}
+
+	CytoFramePtr MappedCytoFrame::copy(uvec row_idx, uvec col_idx, const string & cf_filename, bool overwrite) const
+	{
+		return write_copy(*MemCytoFrame::copy(row_idx, col_idx), cf_filename, overwrite);
+	}
+
+	void MappedCytoFrame::convertToPb(pb::CytoFrame & fr_pb
+			, const string & cf_filename
+			, CytoFileOption h5_opt
+			, const CytoCtx & ctx) const
+	{
+		fr_pb.set_is_h5(true);
+		if(h5_opt == CytoFileOption::skip)
+			return;
+		if(is_h5_container_uri(cf_filename))
+		{
+			if(h5_opt != CytoFileOption::copy && h5_opt != CytoFileOption::move)
+				throw(logic_error("Only 'copy' or 'move' option is supported for archiving to h5 container!"));
+			write_h5_container(*this, cf_filename, ctx.get_h5_write_param());
+		}
+		else
+		{
+			auto dest = fs::path(cf_filename).parent_path();
+			if(!fs::exists(dest))
+				throw(logic_error(dest.string() + "doesn't exist!"));
+			//archived in place, the meta data has been flushed by the caller
+			if(fs::exists(cf_filename) && fs::equivalent(cf_filename, uri_))
+				return;
+			switch(h5_opt)
+			{
+			case CytoFileOption::copy:
+			case CytoFileOption::move:
+				{
+					//the sidecar refers to the events file by name, so both are written instead of copied
+					write_mmap(*this, cf_filename);
+					break;
+				}
+			case CytoFileOption::symlink:
+				{
+					if(fs::exists(cf_filename))
+						fs::remove(cf_filename);
+					fs::create_symlink(fs::absolute(uri_), cf_filename);
+					write_mmap_meta(*this, cf_filename, data_.n_rows, data_.n_cols);
+					break;
+				}
+			case CytoFileOption::link:
+				throw(logic_error("'link' option for MappedCytoFrame is not supported!"));
+			default:
+				throw(logic_error("invalid h5_opt!"));
+			}
+		}
+		if(h5_opt == CytoFileOption::move)
+		{
+			H5FileCache::instance().evict(mmap_meta_path(uri_));
+			fs::remove(uri_);
+			fs::remove(mmap_meta_path(uri_));
+		}
+	}
+};
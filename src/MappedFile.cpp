@@ -0,0 +1,83 @@
+// Copyright 2019 Fred Hutchinson Cancer Research Center
+// See the included LICENSE file for details on the licence that is granted to the user of this software.
+#include <cytolib/MappedFile.hpp>
+#include <stdexcept>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace cytolib
+{
+#ifndef _WIN32
+	MappedFile::MappedFile(const string & filename, int64_t offset, int64_t length, bool writable):addr_(nullptr),map_len_(0),data_(nullptr),size_(0)
+	{
+		if(offset < 0 || length < 0)
+			throw(domain_error("invalid range to map for the file: " + filename));
+		int fd = open(filename.c_str(), O_RDONLY);
+		if(fd < 0)
+			throw(domain_error("can't open the file: " + filename + "\n" + strerror(errno)));
+		struct stat st;
+		if(fstat(fd, &st) != 0)
+		{
+			close(fd);
+			throw(domain_error("can't stat the file: " + filename));
+		}
+		int64_t fsize = st.st_size;
+		if(offset + length > fsize)//never map beyond EOF, which would SIGBUS upon access
+			length = fsize > offset ? fsize - offset : 0;
+		size_ = length;
+		if(size_ > 0)
+		{
+			int64_t pagesize = sysconf(_SC_PAGESIZE);
+			int64_t aligned = offset / pagesize * pagesize;
+			map_len_ = size_ + (offset - aligned);
+			addr_ = mmap(nullptr, map_len_, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, aligned);
+			if(addr_ == MAP_FAILED)
+			{
+				addr_ = nullptr;
+				close(fd);
+				throw(domain_error("failed to map the file: " + filename + "\n" + strerror(errno)));
+			}
+			data_ = static_cast<char *>(addr_) + (offset - aligned);
+		}
+		//the mapping stays valid after the descriptor is closed
+		close(fd);
+	}
+	MappedFile::~MappedFile()
+	{
+		if(addr_)
+			munmap(addr_, map_len_);
+	}
+	void MappedFile::advise_sequential() const
+	{
+		if(addr_)
+			madvise(addr_, map_len_, MADV_SEQUENTIAL);
+	}
+	void MappedFile::advise_random() const
+	{
+		if(addr_)
+			madvise(addr_, map_len_, MADV_RANDOM);
+	}
+	bool MappedFile::is_supported()
+	{
+		return true;
+	}
+#else
+	MappedFile::MappedFile(const string & filename, int64_t offset, int64_t length, bool writable):addr_(nullptr),map_len_(0),data_(nullptr),size_(0)
+	{
+		throw(domain_error("memory mapped file is not supported on this platform!"));
+	}
+	MappedFile::~MappedFile(){}
+	void MappedFile::advise_sequential() const{}
+	void MappedFile::advise_random() const{}
+	bool MappedFile::is_supported()
+	{
+		return false;
+	}
+#endif
+};
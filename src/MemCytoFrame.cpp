@@ -1,9 +1,13 @@
 // Copyright 2019 Fred Hutchinson Cancer Research Center
 // See the included LICENSE file for details on the licence that is granted to the user of this software.
 #include <cytolib/MemCytoFrame.hpp>
+#include <cytolib/MappedFile.hpp>
+#include <cytolib/H5FileCache.hpp>
+#include <cytolib/FCSDecoder.hpp>
 #include <cytolib/cytolibConfig.h>
 #include <boost/lexical_cast.hpp>
 #include <unordered_map>
+#include <unordered_set>
 #include <queue>
 #include <cytolib/global.hpp>
 #include <boost/filesystem.hpp>
@@ -78,7 +82,9 @@ namespace cytolib
 
 	}
 
-	void MemCytoFrame::string_to_keywords(string txt, bool emptyValue){
+	void MemCytoFrame::string_to_keywords(string & txt, bool emptyValue){
+		if(txt.empty())
+			return;
 		/*
 		 * get the first character as delimiter
 		 */
@@ -89,66 +95,57 @@ namespace cytolib
 		 */
 		bool isDelimiterEnd = txt[txt.size()-1] == delimiter;
 
-
-
-		std::string doubleDelimiter,magicString;
-		doubleDelimiter.push_back(delimiter);
-		doubleDelimiter.push_back(delimiter);
-		//search for the first unused odd char as replacememnt for double delimiter
-		//FCS 3.1 states only 0-126 ASCII are legal delimiter, but we can't assume the file always follows the standard
-		//also the TEXT main contain some special characters , thus we want to make sure the replacement char is not used anywhere in FCS TEXT
-		unsigned char oddChar = 127;
-		for(; oddChar < 255; oddChar++)
-		{
-
-			if(oddChar==delimiter||txt.find(oddChar)!=std::string::npos)
-				continue;
-			else
-				break;
-		}
-		if(oddChar==255)
-			throw(domain_error("Can't find the unused odd character from ASCII(127-255) in FSC TEXT section!"));
-
-		std::string soddChar;
-		soddChar.push_back(oddChar);
 		/*
-		 *	when empty value is allowed, we have to take the assumption that there is no double delimiters in any keys or values,
+		 * split the TEXT in a single pass.
+		 * The double delimiters are unescaped in place by compacting the buffer as we go (the write position never passes the read position),
+		 * so each token is just a [begin, end) range of txt instead of a separate string.
+		 * When empty value is allowed, we have to take the assumption that there is no double delimiters in any keys or values,
 		 */
-		if(!emptyValue)//replace the double delimiter with the odd char
-			boost::replace_all(txt, doubleDelimiter, soddChar);
-		std::vector<std::string> tokens;
-		boost::split(tokens, txt, [delimiter](char c){return c == delimiter;});
-//		PRINT( txt + "\n");
+		vector<pair<size_t, size_t>> tokens;
+		size_t nTxt = txt.size();
+		size_t w = 0, tokenStart = 0;
+		for(size_t r = 0; r < nTxt; r++)
+		{
+			char c = txt[r];
+			if(c == delimiter)
+			{
+				if(!emptyValue && r + 1 < nTxt && txt[r+1] == delimiter)
+					r++;//unescape the double delimiter to single one
+				else
+				{
+					tokens.push_back(make_pair(tokenStart, w));
+					tokenStart = w;
+					continue;
+				}
+			}
+			txt[w++] = c;
+		}
+		tokens.push_back(make_pair(tokenStart, w));
+		if(tokens.size() < 2)
+			return;
 
+		auto is_space = [](char c){return isspace(static_cast<unsigned char>(c));};
+		const char * buf = txt.data();
 		unsigned j = isDelimiterEnd?tokens.size()-2:tokens.size()-1;//last token, skip the last empty one when end with delimiter
 		string key;
 		for(unsigned i = 1; i <= j; i++){//counter, start with 1 to skip the first empty tokens
-			std::string token = tokens[i];
-			boost::trim(token);
-//				PRINT( token + " ");
-			if(!emptyValue){
-				/*
-				 * restore double delimiter when needed
-				 * (this slows down things quite a bit, but still a lot faster than R version,
-				 *  and this double delimiter logic is not normally invoked anyway)
-				 */
-
-				boost::replace_all(token, soddChar, string(1, delimiter));//unescape the double delimiter to single one
-	//				std::PRINT( token;
-			}
-//				PRINT("\n");
+			size_t b = tokens[i].first, e = tokens[i].second;
+			//trim
+			while(b < e && is_space(buf[b]))
+				b++;
+			while(e > b && is_space(buf[e-1]))
+				e--;
 
 			if((i)%2 == 1)
 			{
-				if(token.empty())
+				if(b == e)
 					// Rcpp::stop (temporarily switch from stop to range_error due to a bug in Rcpp 0.12.8)
 					throw std::range_error("Empty keyword name detected!If it is due to the double delimiters in keyword value, please set emptyValue to FALSE and try again!");
 
-				key = token;//set key
+				key.assign(buf + b, e - b);//set key
 			}
 			else{
-				keys_[key] = token;//set value
-//				PRINT( token + " ");
+				keys_[key].assign(buf + b, e - b);//set value
 			}
 
 
@@ -178,11 +175,10 @@ namespace cytolib
 	//	    txt <- readBin(con,"raw", offsets["textend"]-offsets["textstart"]+1)
 	//	    txt <- iconv(rawToChar(txt), "", "latin1", sub="byte")
 		 int nTxt = header_.textend - header_.textstart + 1;
-		 char * tmp = new char[nTxt + 1];
-		 in.read(tmp, nTxt);//can't use in.get since it will stop at newline '\n' which could be present in FCS TXT
-		 tmp[nTxt]='\0';//make it as c_string
-		 string txt(tmp);
-		 delete [] tmp;
+		 //read straight into the string that is tokenized in place afterwards
+		 string txt(nTxt, '\0');
+		 in.read(&txt[0], nTxt);//can't use in.get since it will stop at newline '\n' which could be present in FCS TXT
+		 txt.resize(strlen(txt.c_str()));//TEXT ends at the first NUL
 		 boost::trim_right_if(txt, boost::is_any_of(" \t\r\n"));
 	     string_to_keywords(txt, emptyValue);
 
@@ -250,8 +246,12 @@ namespace cytolib
 			, const CytoCtx & ctx) const
 	{
 		fr_pb.set_is_h5(false);
-		if(h5_opt != CytoFileOption::skip)
-			write_h5(h5_filename);
+		if(h5_opt == CytoFileOption::skip)
+			return;
+		if(is_h5_container_uri(h5_filename))
+			write_h5_container(*this, h5_filename, ctx.get_h5_write_param());
+		else
+			write_h5(h5_filename, ctx.get_h5_write_param());
 	}
 
 	unsigned MemCytoFrame::n_rows() const{
@@ -270,6 +270,55 @@ namespace cytolib
 		in_.close();
 	}
 
+	void MemCytoFrame::read_fcs_to_h5(const string & h5_filename, size_t max_buffer_bytes, const H5_WRITE_PARAM & param)
+	{
+		open_fcs_file();
+		read_fcs_header(in_, config_.header);
+		keys_["$CYTOLIB_VERSION"] = CYTOLIB_VERSION;
+
+		hsize_t nCol = config_.data.channels.empty()?n_cols():config_.data.channels.size();
+		size_t nRowSizeBytes = 0;
+		for(const auto & p : params)
+			nRowSizeBytes += (p.PnB + 7)/8;
+		size_t nBlockRows = max<size_t>(1, max_buffer_bytes / (nRowSizeBytes + nCol * sizeof(EVENT_DATA_TYPE)));
+		uint64_t nEvents = boost::lexical_cast<uint64_t>(keys_["$TOT"]);
+
+		H5FileCache::instance().evict(h5_filename);
+		H5File file( h5_filename, H5F_ACC_TRUNC, FileCreatPropList::DEFAULT, h5_create_plist(param));
+		/*
+		 * the events dataset starts empty and is extended as the blocks arrive
+		 * with one chunk per block by default so that each block goes to disk in whole chunks
+		 */
+		hsize_t dimsf[2] = {nCol, 0};
+		hsize_t dim_max[] = {H5S_UNLIMITED, H5S_UNLIMITED};
+		H5_WRITE_PARAM block_param = param;
+		if(block_param.events_per_chunk == 0)
+			block_param.events_per_chunk = nBlockRows;
+		DSetCreatPropList plist = h5_events_plist(block_param, nCol, nEvents);
+		DataSpace dataspace( 2, dimsf, dim_max);
+		DataSet dataset = file.createDataSet( DATASET_NAME, h5_datatype_data(DataTypeLocation::H5), dataspace, plist);
+
+		read_fcs_data(in_, config_.data, nBlockRows, [&](const EVENT_DATA_VEC & block, size_t row_offset){
+			//col-major block is laid out the same as a (nCol x nrow) row-major array, which matches the dataset
+			hsize_t count[2] = {nCol, block.n_rows};
+			hsize_t offset[2] = {0, row_offset};
+			hsize_t new_dims[2] = {nCol, row_offset + block.n_rows};
+			dataset.extend(new_dims);
+			DataSpace filespace = dataset.getSpace();
+			filespace.selectHyperslab(H5S_SELECT_SET, count, offset);
+			DataSpace memspace(2, count);
+			dataset.write(block.memptr(), h5_datatype_data(DataTypeLocation::MEM), memspace, filespace);
+		});
+		in_.close();
+
+		//meta data is written last since params and keywords are only finalized after all the events are parsed
+		write_h5_params(file);
+
+		write_h5_keys(file);
+
+		write_h5_pheno_data(file);
+	}
+
 	void MemCytoFrame::read_fcs_data()
 	{
 		open_fcs_file();
@@ -283,7 +332,8 @@ namespace cytolib
 	 * @param in (input) file stream object opened from FCS file
 	 * @param config (input) the parsing arguments for data
 	 */
-	void MemCytoFrame::read_fcs_data(ifstream &in, const FCS_READ_DATA_PARAM & config)
+	void MemCytoFrame::read_fcs_data(ifstream &in, const FCS_READ_DATA_PARAM & config
+			, size_t max_block_rows, const FCS_BLOCK_WRITER & block_writer)
 	{
 		if(g_loglevel>=GATING_HIERARCHY_LEVEL)
 			PRINT("Parsing FCS data section \n");
@@ -400,9 +450,8 @@ namespace cytolib
 //
 
 
-	  in.seekg(header_.datastart);
-
 	  auto nBytes = header_.dataend - header_.datastart + 1;
+	  auto nDataBytes = nBytes;
 
 
 	//	vector<BYTE>bytes(nBytes);
@@ -417,16 +466,42 @@ namespace cytolib
 
 	  	auto which_lines = config.which_lines;
 	  	auto nSelected = which_lines.size();
+	  	if(nSelected > 0 && block_writer)
+	  		throw(domain_error("which_lines is not supported when the events are decoded in blocks!"));
 	  	//randomly sample the data if the given lines are of size 1
 	  	if(nSelected == 1)
 	  	{
 	  		nSelected = which_lines[0];
 	  		which_lines.resize(nSelected);
+	  		if(nSelected >= nrow)
+	  			throw(domain_error("total number of which.lines exceeds the total number of events: " + to_string(nrow)));
 	  		std::default_random_engine generator(config.seed);
-	  		std::uniform_int_distribution<int64_t> distribution(0, nrow - 1);
-	  		for(uint64_t i = 0; i < nSelected; i++)
+	  		if(config.sample_without_replacement)
+	  		{
+	  			/*
+	  			 * Floyd's algorithm: draws nSelected distinct rows with nSelected draws
+	  			 * regardless of how close nSelected is to nrow
+	  			 */
+	  			unordered_set<int64_t> picked(nSelected);
+	  			uint64_t i = 0;
+	  			for(int64_t r = nrow - nSelected; r < static_cast<int64_t>(nrow); r++)
+	  			{
+	  				int64_t v = std::uniform_int_distribution<int64_t>(0, r)(generator);
+	  				if(!picked.insert(v).second)
+	  				{
+	  					v = r;
+	  					picked.insert(v);
+	  				}
+	  				which_lines[i++] = v;
+	  			}
+	  		}
+	  		else
 	  		{
-	  			which_lines[i] = distribution(generator);
+	  			std::uniform_int_distribution<int64_t> distribution(0, nrow - 1);
+	  			for(uint64_t i = 0; i < nSelected; i++)
+	  			{
+	  				which_lines[i] = distribution(generator);
+	  			}
 	  		}
 	  	}
 	  	if(nSelected>0){
@@ -437,28 +512,107 @@ namespace cytolib
 	  		nrow = nSelected;
 	  		nBytes = nrow * nRowSize/8;
 	  	}
-	  	unique_ptr<char []> buf(new char[nBytes]);//we need to rearrange dat from row-major to col-major thus need a separate buf anyway (even for float)
-	  	char * bufPtr = buf.get();
+	  	/*
+	  	 * When mmap is enabled, the DATA segment is decoded straight from the mapped pages,
+	  	 * which avoids holding the raw bytes and the decoded matrix in memory at the same time.
+	  	 * Otherwise we need a separate buffer since data has to be rearranged from row-major to col-major anyway (even for float)
+	  	 * Block decoding reads each block into its own small buffer, so mmap is not used there.
+	  	 */
+	  	bool use_mmap = config.use_mmap && MappedFile::is_supported() && !block_writer;
+	  	unique_ptr<MappedFile> mapped;
+	  	unique_ptr<char []> buf;
+	  	char * bufPtr = nullptr;
+	  	if(use_mmap)
+	  	{
+	  		mapped.reset(new MappedFile(filename_, header_.datastart, nDataBytes));
+	  		if(nSelected>0)
+	  			mapped->advise_random();
+	  		else
+	  			mapped->advise_sequential();
+	  	}
+	  	else
+	  		in.seekg(header_.datastart);
+
 	  	if(nSelected>0)
 	  	{
+	  		buf.reset(new char[nBytes]);
+	  		bufPtr = buf.get();
 	  		char * thisBufPtr = bufPtr;
-	  		auto nRowSizeBytes = nRowSize/8;
+	  		int64_t nRowSizeBytes = nRowSize/8;
 	  		for(auto i : which_lines)
 	  		{
 	  			int64_t pos =  header_.datastart + i * nRowSizeBytes;
 	  			if(pos > header_.dataend || pos < header_.datastart)
 	  				throw(domain_error("the index of which.lines exceeds the data boundary: " + to_string(i)));
-	  			in.seekg(pos);
-	  			in.read(thisBufPtr, nRowSizeBytes);
-	  			thisBufPtr += nRowSizeBytes;
+	  			if(use_mmap && (i + 1) * nRowSizeBytes > static_cast<int64_t>(mapped->size()))
+	  				throw(domain_error("the index of which.lines exceeds the data boundary: " + to_string(i)));
+	  		}
+	  		if(use_mmap)
+	  		{
+	  			for(auto i : which_lines)
+	  			{
+	  				memcpy(thisBufPtr, mapped->data() + i * nRowSizeBytes, nRowSizeBytes);
+	  				thisBufPtr += nRowSizeBytes;
+	  			}
+	  		}
+	  		else
+	  		{
+	  			/*
+	  			 * coalesce the sorted rows into spans, so that the rows that are close to each other are fetched
+	  			 * by a single read instead of one seek and read per row.
+	  			 * A span is closed when the gap to the next row or its total size gets too large.
+	  			 */
+	  			vector<char> span;
+	  			size_t k = 0;
+	  			while(k < nSelected)
+	  			{
+	  				int64_t first = which_lines[k];
+	  				size_t m = k + 1;
+	  				while(m < nSelected
+	  						&& (which_lines[m] - which_lines[m-1]) * nRowSizeBytes <= static_cast<int64_t>(FCS_COALESCE_GAP_BYTES)
+	  						&& (which_lines[m] - first + 1) * nRowSizeBytes <= static_cast<int64_t>(FCS_COALESCE_SPAN_BYTES))
+	  					m++;
+	  				int64_t nSpanBytes = (which_lines[m-1] - first + 1) * nRowSizeBytes;
+	  				if(static_cast<int64_t>(span.size()) < nSpanBytes)
+	  					span.resize(nSpanBytes);
+	  				in.seekg(header_.datastart + first * nRowSizeBytes);
+	  				in.read(span.data(), nSpanBytes);
+	  				for(; k < m; k++)
+	  				{
+	  					memcpy(thisBufPtr, span.data() + (which_lines[k] - first) * nRowSizeBytes, nRowSizeBytes);
+	  					thisBufPtr += nRowSizeBytes;
+	  				}
+	  			}
 	  		}
 	  	}
 	  	else
 	  	{
-	  		//load entire data section with one disk IO
-
-			in.read(bufPtr, nBytes); //load the bytes from file
-			uint64_t events_read = (in.gcount() * 8 / nRowSize);
+	  		uint64_t events_read;
+	  		if(use_mmap)
+	  		{
+	  			bufPtr = mapped->data();
+	  			events_read = mapped->size() * 8 / nRowSize;
+	  			//the rows are counted from the header, whereas the mapping stops at the end of the file
+	  			if(static_cast<uint64_t>(nrow) * nRowSize / 8 > mapped->size())
+	  				throw(domain_error("file " + filename_+ " seems to be corrupted. \n The DATA segment ("
+	  						+ to_string(mapped->size()) + " bytes) is shorter than stated by the header (" + to_string(nBytes) + " bytes)"));
+	  		}
+	  		else if(block_writer)
+	  		{
+	  			//the bytes are read later block by block, so count the events from the size of the file instead
+	  			in.seekg(0, ios::end);
+	  			int64_t nAvailBytes = min<int64_t>(nBytes, static_cast<int64_t>(in.tellg()) - header_.datastart);
+	  			events_read = max<int64_t>(nAvailBytes, 0) * 8 / nRowSize;
+	  			in.seekg(header_.datastart);
+	  		}
+	  		else
+	  		{
+	  			//load entire data section with one disk IO
+	  			buf.reset(new char[nBytes]);
+	  			bufPtr = buf.get();
+	  			in.read(bufPtr, nBytes); //load the bytes from file
+	  			events_read = (in.gcount() * 8 / nRowSize);
+	  		}
 			uint64_t events_expected = boost::lexical_cast<uint64_t>(keys_["$TOT"]);
 			if(events_read != events_expected)//can't use nBytes derived from FCS header as the check point since it may have extra bytes than needed
 			{
@@ -468,10 +622,6 @@ namespace cytolib
 
 	  	}
 	//	nEvents = nrow;
-		//how many element to return
-	  	auto nElement = nrow * nCol;
-
-	  	data_.resize(nrow, nCol);
 
 	//	char *p = buf.get();//pointer to the current beginning byte location of the processing data element in the byte stream
 		float decade = pow(10, config.decades);
@@ -481,6 +631,7 @@ namespace cytolib
 		 * but since it is a rare case (legacy data), we do the separate simple
 		 * preprocessing here to avoid adding extra overhead into the main loop
 		 */
+		vector<int> iByteOrd;
 		if(endian == endianType::mixed)
 		{
 			  if(multiSize)
@@ -493,15 +644,23 @@ namespace cytolib
 			  if(params[0].PnB/8 != elementSize)
 				throw(domain_error("Byte order is not consistent with bidwidths!"));
 
-			  vector<int> iByteOrd(elementSize);
+			  iByteOrd.resize(elementSize);
 			  for(auto i = 0; i < elementSize; i++)
 			  {
 				  iByteOrd[i] = boost::lexical_cast<int>(byteOrd[i])-1;
 			  }
-			  char * tmp = new char[elementSize];
+
+			    endian = endianType::small;
+		}
+		/*
+		 * reorder the bytes of the first nElement elements of p in place
+		 */
+		auto reorder_mixed_endian = [&iByteOrd](char * p, size_t nElement){
+			  int elementSize = iByteOrd.size();
+			  vector<char> tmp(elementSize);
 			  for(size_t ind = 0; ind < nElement; ind++){
 
-				  memcpy(tmp, bufPtr + ind * elementSize, elementSize);
+				  memcpy(tmp.data(), p + ind * elementSize, elementSize);
 
 			     for(auto i = 0; i < elementSize; i++){
 			       auto j = iByteOrd[i];
@@ -512,131 +671,91 @@ namespace cytolib
 			 //         Rcpp::Rcout << pos_old <<":" << pos_new << std::endl;
 
 
-			       bufPtr[pos_new] = tmp[i];
+			       p[pos_new] = tmp[i];
 
 			     }
 
 			   }
-			  	delete [] tmp;
-
-			    endian = endianType::small;
-		}
+		};
 
 		bool isbyteswap = false;
 
 		if((is_host_big_endian()&&endian==endianType::small)||(!is_host_big_endian()&&endian==endianType::big))
 			isbyteswap = true;
 
+		/*
+		 * the columns to be decoded, in the order they are requested
+		 */
+		vector<int> selectedCols;
+		if(config.channels.empty())
+		{
+			selectedCols.resize(nCol);
+			iota(selectedCols.begin(), selectedCols.end(), 0);
+		}
+		else
+		{
+			for(const auto & ch : config.channels)
+			{
+				auto it = find_if(params.begin(), params.end(), [&ch](const cytoParam & p){return p.channel == ch;});
+				if(it == params.end())
+					throw(domain_error("channel not found in FCS: " + ch));
+				selectedCols.push_back(it - params.begin());
+			}
+		}
+		int nSelectedCol = selectedCols.size();
+		vector<bool> isSelected(nCol, false);
+		for(auto c : selectedCols)
+			isSelected[c] = true;
+
 		/**
 		 * cp raw bytes(row-major) to a 2d mat (col-major) represented as 1d array(with different byte width for each elements)
+		 * The decode kernel is selected once per column so that the inner loops are free of any type dispatch
 		 */
-	//	double start = omp_get_wtime();//clock();
-	#ifdef _OPENMP
-		omp_set_num_threads(config.num_threads);
-	#endif
-
-	    #pragma omp parallel for
+		vector<FCS_DECODER> decoders(nCol);
+		vector<size_t> byte_offsets(nCol);
+		vector<uint64_t> masks(nCol, numeric_limits<uint64_t>::max());
+		size_t nRowSizeBytes = nRowSize/8;
+		size_t byte_offset = 0;
 		for(auto c = 0; c < nCol; c++)
-		 {
-			string pid = to_string(c+1);
-			EVENT_DATA_TYPE realMin = numeric_limits<EVENT_DATA_TYPE>::max();
-//			size_t element_offset = nrow * c;
-			size_t bits_offset = accumulate(params.begin(), params.begin() + c, 0, [](size_t i, cytoParam p){return i + p.PnB;});
+		{
 			cytoParam & param = params[c];
-			int usedBits = ceil(log2(param.max));
-		    uint64_t base = static_cast<uint64_t>(1)<<usedBits;
-//		    auto thisSize = params[c-1].PnB;
-			for(size_t r = 0; r < nrow; r++)
-		    {
-		      //convert each element
-				  auto thisSize = param.PnB;
-//				  size_t idx = element_offset + r;
-				  EVENT_DATA_TYPE & outElement = data_.at(r, c);
-				  size_t idx_bits = r * nRowSize + bits_offset;
-				  char *p = bufPtr + idx_bits/8;
-				  thisSize/=8;
-				  if(isbyteswap)
-					  std::reverse(p, p + thisSize);
-
-				  if(dattype == "I")
-				  {
-					  switch(thisSize)
-					  {
-					  case sizeof(BYTE)://1 byte
-						{
-						  outElement = static_cast<EVENT_DATA_TYPE>(*p);
-						}
-
-						  break;
-					  case sizeof(unsigned short): //2 bytes
-						{
-
-						  outElement = static_cast<EVENT_DATA_TYPE>(*reinterpret_cast<unsigned short *>(p));
-						}
-
-						break;
-					  case sizeof(unsigned)://4 bytes
-						{
-						  outElement = static_cast<EVENT_DATA_TYPE>(*reinterpret_cast<unsigned *>(p));
-						}
-
-						break;
-					  case sizeof(uint64_t)://8 bytes
-						{
-						  outElement = static_cast<EVENT_DATA_TYPE>(*reinterpret_cast<uint64_t *>(p));
-						}
-
-					  break;
-					  default:
-						  {
-							  std::string serror = "unsupported byte width :";
-							  serror.append(std::to_string(thisSize));
-							  throw std::range_error(serror.c_str());
-						  }
-					  }
-					  // apply bitmask for integer data
-
-					 if(param.max > 0)
-					 {
-
-					   if(usedBits < param.PnB)
-						   outElement = static_cast<uint64_t>(outElement) % base;
-					}
-
+			decoders[c] = get_fcs_decoder(dattype, param.PnB/8, isbyteswap);
+			byte_offsets[c] = byte_offset;
+			byte_offset += param.PnB/8;
+			// apply bitmask for integer data
+			if(dattype == "I" && param.max > 0)
+			{
+				int usedBits = ceil(log2(param.max));
+				if(usedBits < param.PnB)
+					masks[c] = (static_cast<uint64_t>(1)<<usedBits) - 1;
+			}
+		}
 
-				}
-				else
+		/*
+		 * decode the rows [r0, r0 + n) of column c from the raw rows in src to the column outCol of out
+		 * The steps after the raw decode are done as separate passes over the contiguous output
+		 * so that each of them stays a simple loop that the compiler can vectorize
+		 */
+		auto decode_block = [&](const char * src, EVENT_DATA_VEC & out, int c, int outCol, size_t r0, size_t n, EVENT_DATA_TYPE & realMin){
+			cytoParam & param = params[c];
+			EVENT_DATA_TYPE * col = out.colptr(outCol) + r0;
+			decoders[c](src + r0 * nRowSizeBytes + byte_offsets[c], nRowSizeBytes, n, masks[c], col);
+			// truncate data at range
+			if(!transDefinedinKeys)
+			{
+				if(config.truncate_max_range)
 				{
-				  switch(thisSize)
-				  {
-				  case sizeof(float):
-					{
-					  outElement = *reinterpret_cast<float *>(p);
-					}
-
-					break;
-				  case sizeof(double):
-					{
-					  outElement = static_cast<EVENT_DATA_TYPE>(*reinterpret_cast<double *>(p));
-					}
-
-					break;
-				  default:
-					std::string serror ="Unsupported bitwidths for numerical data type:";
-					serror.append(std::to_string(thisSize));
-					throw std::range_error(serror.c_str());
-				  }
+					EVENT_DATA_TYPE vmax = param.max;
+					for(size_t r = 0; r < n; r++)
+						col[r] = col[r] > vmax ? vmax : col[r];
 				}
-
-			  // truncate data at range
-				if(!transDefinedinKeys)
+				if(config.truncate_min_val)
 				{
-					if(config.truncate_max_range&&outElement > param.max)
-						outElement = param.max;
-
-					if(config.truncate_min_val&&outElement < config.min_limit)
-						outElement = config.min_limit;
+					EVENT_DATA_TYPE vmin = config.min_limit;
+					for(size_t r = 0; r < n; r++)
+						col[r] = col[r] < vmin ? vmin : col[r];
 				}
+			}
 
 
 
@@ -651,44 +770,119 @@ namespace cytolib
 	//				# compatible with previous versions.
 
 
-				if(isTransformation)
+			if(isTransformation)
+			{
+			  if(param.PnE[0] > 0)
+			  {
+				  for(size_t r = 0; r < n; r++)
+					  col[r] = pow(10,col[r]/param.max * param.PnE[0]) * param.PnE[1];
+			  }
+			  else if (fcsPnGtransform && param.PnG != 1) {
+				  for(size_t r = 0; r < n; r++)
+					  col[r] = col[r] / param.PnG;
+			  }
+			}
+			if(scale)
+			{
+				if(param.PnE[0] > 0)
 				{
-
-
-				  if(param.PnE[0] > 0)
-				  {
-					 outElement = pow(10,outElement/param.max * param.PnE[0]) * param.PnE[1];
-				  }
-				  else if (fcsPnGtransform && param.PnG != 1) {
-					  outElement = outElement / param.PnG;
-				  }
+					for(size_t r = 0; r < n; r++)
+						col[r] = decade*((col[r]-1)/(param.max-1));
 				}
-				if(scale)
+				else
 				{
-					if(param.PnE[0] > 0)
-					{
-						outElement = decade*((outElement-1)/(param.max-1));
-					}
-					else
-					{
-						outElement = decade*((outElement)/(param.max));
-					}
+					for(size_t r = 0; r < n; r++)
+						col[r] = decade*((col[r])/(param.max));
+				}
+			}
+			for(size_t r = 0; r < n; r++)
+				realMin = realMin > col[r]?col[r]:realMin;
+		};
+
+		/*
+		 * The work is split into blocks of rows instead of columns.
+		 * Each thread reads its own contiguous slice of the DATA segment once and scatters it to all the columns
+		 * while the slice is still in cache, instead of every thread striding through the entire segment.
+		 */
+		size_t nBlockRows = max<size_t>(1, FCS_DECODE_BLOCK_BYTES / max<size_t>(1, nRowSizeBytes));
+		vector<EVENT_DATA_TYPE> colMins(nCol, numeric_limits<EVENT_DATA_TYPE>::max());
+	//	double start = omp_get_wtime();//clock();
+	#ifdef _OPENMP
+		omp_set_num_threads(config.num_threads);
+	#endif
+		/*
+		 * decode the first n rows of src into out
+		 */
+		auto decode_rows = [&](const char * src, EVENT_DATA_VEC & out, size_t n){
+			int64_t nBlocks = (n + nBlockRows - 1) / nBlockRows;
+			#pragma omp parallel
+			{
+				vector<EVENT_DATA_TYPE> localMins(nCol, numeric_limits<EVENT_DATA_TYPE>::max());
+				#pragma omp for schedule(static)
+				for(int64_t b = 0; b < nBlocks; b++)
+				{
+					size_t r0 = b * nBlockRows;
+					size_t nr = min<size_t>(nBlockRows, n - r0);
+					for(int j = 0; j < nSelectedCol; j++)
+						decode_block(src, out, selectedCols[j], j, r0, nr, localMins[selectedCols[j]]);
 				}
-				realMin = realMin > outElement?outElement:realMin;
+				#pragma omp critical
+				for(auto c = 0; c < nCol; c++)
+					colMins[c] = colMins[c] > localMins[c]?localMins[c]:colMins[c];
+			}
+		};
 
-		    }
+		if(block_writer)
+		{
+			/*
+			 * read, decode and hand over max_block_rows events at a time
+			 * so that neither the raw bytes nor the decoded events of the entire DATA segment are held in memory
+			 */
+			size_t nChunkRows = max<size_t>(1, min<size_t>(max_block_rows, nrow));
+			unique_ptr<char []> chunk_buf(new char[nChunkRows * nRowSizeBytes]);
+			EVENT_DATA_VEC block;
+			for(size_t r0 = 0; r0 < nrow; r0 += nChunkRows)
+			{
+				size_t n = min<size_t>(nChunkRows, nrow - r0);
+				in.read(chunk_buf.get(), n * nRowSizeBytes);
+				if(!iByteOrd.empty())
+					reorder_mixed_endian(chunk_buf.get(), n * nCol);
+				block.set_size(n, nSelectedCol);
+				decode_rows(chunk_buf.get(), block, n);
+				block_writer(block, r0);
+			}
+		}
+		else
+		{
+			if(!iByteOrd.empty())
+			{
+				//the mapped pages are read-only, so reorder a copy of them
+				if(mapped && bufPtr == mapped->data())
+				{
+					buf.reset(new char[nrow * nRowSizeBytes]);
+					memcpy(buf.get(), bufPtr, nrow * nRowSizeBytes);
+					bufPtr = buf.get();
+				}
+				reorder_mixed_endian(bufPtr, nrow * nCol);
+			}
+			data_.resize(nrow, nSelectedCol);
+			decode_rows(bufPtr, data_, nrow);
+		}
 
+		for(auto c = 0; c < nCol; c++)
+		{
+			string pid = to_string(c+1);
+			cytoParam & param = params[c];
 			if(keys_.find("transformation")!=keys_.end() &&  keys_["transformation"] == "custom")
 				param.min = boost::lexical_cast<EVENT_DATA_TYPE>(keys_["flowCore_$P" + pid + "Rmin"]);
-			else
+			else if(isSelected[c])//columns that are not read keep the min from header
 			{
 
 				auto zeroVals = param.PnE[1];
-				param.min = min(zeroVals, max(config.min_limit, realMin));
+				param.min = min(zeroVals, max(config.min_limit, colMins[c]));
 
 			}
-
-		 }
+		}
 	//	 cout << (std::clock() - start) / (double)(CLOCKS_PER_SEC / 1000) << endl;
 	//	 cout << (omp_get_wtime() - start) / (double)(CLOCKS_PER_SEC / 1000) << endl;
 
@@ -762,6 +956,9 @@ namespace cytolib
 
 		keys_["GUID"] = fs::path(filename_).filename().string();
 
+		//drop the columns that are not read only at the end since the keywords above are indexed by the original parameter number
+		if(nSelectedCol < nCol)
+			subset_parameters(conv_to<uvec>::from(selectedCols));
 	}
 
 	void MemCytoFrame::read_fcs_header()
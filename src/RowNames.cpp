@@ -0,0 +1,561 @@
+// Copyright 2019 Fred Hutchinson Cancer Research Center
+// See the included LICENSE file for details on the licence that is granted to the user of this software.
+#include <cytolib/RowNames.hpp>
+#include <stdexcept>
+#include <algorithm>
+
+namespace cytolib
+{
+	/**
+	 * the number of the elements per chunk of the rownames datasets
+	 */
+	const hsize_t ROWNAME_CHUNK_SIZE = 65536;
+
+	/**
+	 * parse the canonical decimal (no sign or leading zero) that ends the string, so that it is written back as it is
+	 */
+	static bool parse_id(const string & s, size_t pos, int64_t & id)
+	{
+		size_t len = s.size() - pos;
+		if(len == 0 || len > 18 || (len > 1 && s[pos] == '0'))
+			return false;
+		id = 0;
+		for(size_t i = pos; i < s.size(); i++)
+		{
+			if(s[i] < '0' || s[i] > '9')
+				return false;
+			id = id * 10 + (s[i] - '0');
+		}
+		return true;
+	}
+
+	static bool is_consecutive(const vector<int64_t> & ids)
+	{
+		for(size_t i = 1; i < ids.size(); i++)
+			if(ids[i] != ids[0] + static_cast<int64_t>(i))
+				return false;
+		return true;
+	}
+
+	uint64_t RowNames::Store::size() const
+	{
+		switch(encoding)
+		{
+		case Encoding::counter:
+			return count;
+		case Encoding::ids:
+			return ids.size();
+		default:
+			return offsets.empty() ? 0 : offsets.size() - 1;
+		}
+	}
+
+	void RowNames::Store::append_name(uint64_t i, string & out) const
+	{
+		switch(encoding)
+		{
+		case Encoding::counter:
+			out += prefix;
+			out += to_string(start + static_cast<int64_t>(i));
+			break;
+		case Encoding::ids:
+			out += prefix;
+			out += to_string(ids[i]);
+			break;
+		default:
+			out.append(pool, offsets[i], offsets[i + 1] - offsets[i]);
+		}
+	}
+
+	RowNames::RowNames():is_indexed_(false){}
+
+	RowNames::RowNames(shared_ptr<const Store> store):store_(store),is_indexed_(false){}
+
+	RowNames::RowNames(const vector<string> & names):is_indexed_(false)
+	{
+		if(names.empty())
+			return;
+		//the prefix is whatever precedes the trailing digits of the first name
+		const string & first = names[0];
+		size_t pos = first.size();
+		while(pos > 0 && first[pos - 1] >= '0' && first[pos - 1] <= '9')
+			pos--;
+		string prefix = first.substr(0, pos);
+		vector<int64_t> ids(names.size());
+		bool is_id = true;
+		for(size_t i = 0; i < names.size() && is_id; i++)
+			is_id = names[i].compare(0, pos, prefix) == 0 && parse_id(names[i], pos, ids[i]);
+		if(is_id)
+		{
+			*this = encode_ids(std::move(ids), prefix);
+			return;
+		}
+		uint64_t nbytes = 0;
+		for(const auto & s : names)
+			nbytes += s.size();
+		string pool;
+		pool.reserve(nbytes);
+		vector<uint64_t> offsets;
+		offsets.reserve(names.size() + 1);
+		for(const auto & s : names)
+		{
+			offsets.push_back(pool.size());
+			pool += s;
+		}
+		offsets.push_back(pool.size());
+		*this = from_pool(std::move(pool), std::move(offsets));
+	}
+
+	RowNames RowNames::counter(uint64_t n, int64_t start, const string & prefix)
+	{
+		auto store = make_shared<Store>();
+		store->encoding = Encoding::counter;
+		store->prefix = prefix;
+		store->start = start;
+		store->count = n;
+		return RowNames(store);
+	}
+
+	RowNames RowNames::from_ids(vector<int64_t> ids, const string & prefix)
+	{
+		auto store = make_shared<Store>();
+		store->encoding = Encoding::ids;
+		store->prefix = prefix;
+		store->ids = std::move(ids);
+		return RowNames(store);
+	}
+
+	RowNames RowNames::from_pool(string pool, vector<uint64_t> offsets)
+	{
+		if(!offsets.empty() && (offsets.back() > pool.size() || !is_sorted(offsets.begin(), offsets.end())))
+			throw(domain_error("invalid offsets of the rownames pool!"));
+		auto store = make_shared<Store>();
+		store->encoding = Encoding::pool;
+		store->pool = std::move(pool);
+		store->offsets = std::move(offsets);
+		return RowNames(store);
+	}
+
+	RowNames RowNames::encode_ids(vector<int64_t> ids, const string & prefix)
+	{
+		if(!ids.empty() && is_consecutive(ids))
+			return counter(ids.size(), ids[0], prefix);
+		return from_ids(std::move(ids), prefix);
+	}
+
+	bool RowNames::as_ids(string & prefix, vector<int64_t> & ids) const
+	{
+		if(!store_ || store_->encoding == Encoding::pool)
+			return false;
+		prefix = store_->prefix;
+		uint64_t n = size();
+		ids.resize(n);
+		for(uint64_t i = 0; i < n; i++)
+		{
+			uint64_t j = store_index(i);
+			ids[i] = store_->encoding == Encoding::counter ? store_->start + static_cast<int64_t>(j) : store_->ids[j];
+		}
+		return true;
+	}
+
+	string RowNames::operator[](uint64_t i) const
+	{
+		if(i >= size())
+			throw(domain_error("rowname index out of bound: " + to_string(i)));
+		string res;
+		store_->append_name(store_index(i), res);
+		return res;
+	}
+
+	vector<string> RowNames::to_vector() const
+	{
+		uint64_t n = size();
+		vector<string> res(n);
+		for(uint64_t i = 0; i < n; i++)
+			store_->append_name(store_index(i), res[i]);
+		return res;
+	}
+
+	RowNames RowNames::subset(const arma::uvec & idx) const
+	{
+		if(idx.n_elem == 0)
+			return RowNames();
+		if(idx.max() >= size())
+			throw(domain_error("rowname index out of bound: " + to_string(idx.max())));
+		RowNames res(store_);
+		res.is_indexed_ = true;
+		res.idx_ = is_indexed_ ? arma::uvec(idx_.elem(idx)) : idx;
+		return res;
+	}
+
+	RowNames RowNames::concat(const RowNames & other) const
+	{
+		if(other.empty())
+			return *this;
+		if(empty())
+			return other;
+		string prefix1, prefix2;
+		vector<int64_t> ids1, ids2;
+		if(as_ids(prefix1, ids1) && other.as_ids(prefix2, ids2) && prefix1 == prefix2)
+		{
+			ids1.insert(ids1.end(), ids2.begin(), ids2.end());
+			return encode_ids(std::move(ids1), prefix1);
+		}
+		string pool;
+		vector<uint64_t> offsets;
+		offsets.reserve(size() + other.size() + 1);
+		append_pool(pool, offsets);
+		other.append_pool(pool, offsets);
+		offsets.push_back(pool.size());
+		return from_pool(std::move(pool), std::move(offsets));
+	}
+
+	void RowNames::append_pool(string & pool, vector<uint64_t> & offsets) const
+	{
+		for(uint64_t i = 0; i < size(); i++)
+		{
+			offsets.push_back(pool.size());
+			store_->append_name(store_index(i), pool);
+		}
+	}
+
+	RowNames RowNames::realize() const
+	{
+		if(!is_indexed_)
+			return *this;
+		string prefix;
+		vector<int64_t> ids;
+		if(as_ids(prefix, ids))
+			return encode_ids(std::move(ids), prefix);
+		string pool;
+		vector<uint64_t> offsets;
+		offsets.reserve(size() + 1);
+		append_pool(pool, offsets);
+		offsets.push_back(pool.size());
+		return from_pool(std::move(pool), std::move(offsets));
+	}
+
+	RowNames::Encoding RowNames::get_encoding() const
+	{
+		return store_ ? store_->encoding : Encoding::counter;
+	}
+
+	bool RowNames::operator==(const RowNames & other) const
+	{
+		uint64_t n = size();
+		if(n != other.size())
+			return false;
+		if(store_ == other.store_ && is_indexed_ == other.is_indexed_ && (!is_indexed_ || arma::all(idx_ == other.idx_)))
+			return true;
+		string s1, s2;
+		for(uint64_t i = 0; i < n; i++)
+		{
+			s1.clear();
+			s2.clear();
+			store_->append_name(store_index(i), s1);
+			other.store_->append_name(other.store_index(i), s2);
+			if(s1 != s2)
+				return false;
+		}
+		return true;
+	}
+
+	static void write_prefix(const DataSet & ds, const string & prefix)
+	{
+		StrType str_type(PredType::C_S1, H5T_VARIABLE);
+		Attribute attr = ds.createAttribute("prefix", str_type, DataSpace(H5S_SCALAR));
+		attr.write(str_type, prefix);
+	}
+
+	static string read_prefix(const DataSet & ds)
+	{
+		string prefix;
+		Attribute attr = ds.openAttribute("prefix");
+		attr.read(attr.getStrType(), prefix);
+		return prefix;
+	}
+
+	/**
+	 * create the extendible 1-d dataset and write the values
+	 */
+	static DataSet write_h5_vec(const H5Location & loc, const string & name, const DataType & type, const void * buf, hsize_t n)
+	{
+		hsize_t dims[1] = {n};
+		hsize_t dim_max[1] = {H5S_UNLIMITED};
+		hsize_t chunk_dims[1] = {max<hsize_t>(1, min(n, ROWNAME_CHUNK_SIZE))};
+		DSetCreatPropList plist;
+		plist.setChunk(1, chunk_dims);
+		DataSet ds = loc.createDataSet(name, type, DataSpace(1, dims, dim_max), plist);
+		if(n > 0)
+			ds.write(buf, type);
+		return ds;
+	}
+
+	/**
+	 * extend the 1-d dataset by the values
+	 */
+	static void append_h5_vec(DataSet & ds, const DataType & type, const void * buf, hsize_t n)
+	{
+		if(n == 0)
+			return;
+		hsize_t dims[1];
+		ds.getSpace().getSimpleExtentDims(dims);
+		hsize_t size[1] = {dims[0] + n};
+		ds.extend(size);
+		hsize_t offset[1] = {dims[0]};
+		hsize_t count[1] = {n};
+		DataSpace filespace = ds.getSpace();
+		filespace.selectHyperslab(H5S_SELECT_SET, count, offset);
+		DataSpace memspace(1, count);
+		ds.write(buf, type, memspace, filespace);
+	}
+
+	static hsize_t h5_vec_size(const DataSet & ds)
+	{
+		hsize_t dims[1];
+		ds.getSpace().getSimpleExtentDims(dims);
+		return dims[0];
+	}
+
+	static bool exists_h5_compact(const H5Location & loc)
+	{
+		for(const auto & name : {DATASET_ROWNAME_COUNTER, DATASET_ROWNAME_IDS, DATASET_ROWNAME_POOL})
+			if(loc.exists(name))
+				return true;
+		return false;
+	}
+
+	static void remove_h5_compact(const H5Location & loc)
+	{
+		for(const auto & name : {DATASET_ROWNAME_COUNTER, DATASET_ROWNAME_IDS, DATASET_ROWNAME_POOL, DATASET_ROWNAME_OFFSETS})
+			if(loc.exists(name))
+				loc.unlink(name);
+	}
+
+	bool RowNames::exists_h5(const H5Location & loc)
+	{
+		return loc.exists(DATASET_ROWNAME) || exists_h5_compact(loc);
+	}
+
+	void RowNames::remove_h5(const H5Location & loc)
+	{
+		remove_h5_compact(loc);
+		if(loc.exists(DATASET_ROWNAME))
+			loc.unlink(DATASET_ROWNAME);
+	}
+
+	/**
+	 * create the extendible dataset of the variable-length strings, i.e. the format of the earlier versions
+	 */
+	static void write_h5_legacy(const H5Location & loc, const vector<string> & names)
+	{
+		StrType str_type(PredType::C_S1, H5T_VARIABLE);
+		hsize_t n = names.size();
+		hsize_t dims[1] = {n};
+		hsize_t dim_max[1] = {H5S_UNLIMITED};
+		hsize_t chunk_dims[1] = {max<hsize_t>(1, min<hsize_t>(n, 4096))};
+		DSetCreatPropList plist;
+		plist.setChunk(1, chunk_dims);
+		DataSet ds = loc.createDataSet(DATASET_ROWNAME, str_type, DataSpace(1, dims, dim_max), plist);
+		// HDF5 only understands vector of char* :-(
+		vector<const char *> rn_c_str(n);
+		for(hsize_t i = 0; i < n; i++)
+			rn_c_str[i] = names[i].c_str();
+		if(n > 0)
+			ds.write(rn_c_str.data(), str_type);
+	}
+
+	static vector<string> read_h5_legacy(const H5Location & loc)
+	{
+		DataSet ds = loc.openDataSet(DATASET_ROWNAME);
+		hsize_t n = h5_vec_size(ds);
+		vector<string> names(n);
+		if(n > 0)
+		{
+			StrType str_type(PredType::C_S1, H5T_VARIABLE);
+			DataSpace memspace(1, &n);
+			vector<char *> rn_c_str(n);
+			ds.read(rn_c_str.data(), str_type, memspace, ds.getSpace());
+			for(hsize_t i = 0; i < n; i++)
+				names[i] = rn_c_str[i];
+			DataSet::vlenReclaim(rn_c_str.data(), str_type, memspace);
+		}
+		return names;
+	}
+
+	/**
+	 * extend the variable-length strings in place.
+	 * The fixed-size dataset of the earlier versions is recreated as the extendible one of the same type
+	 */
+	static void append_h5_legacy(const H5Location & loc, const vector<string> & names)
+	{
+		DataSet ds = loc.openDataSet(DATASET_ROWNAME);
+		hsize_t dim_max[1];
+		ds.getSpace().getSimpleExtentDims(NULL, dim_max);
+		if(dim_max[0] != H5S_UNLIMITED)
+		{
+			ds.close();
+			auto all = read_h5_legacy(loc);
+			all.insert(all.end(), names.begin(), names.end());
+			loc.unlink(DATASET_ROWNAME);
+			write_h5_legacy(loc, all);
+			return;
+		}
+		StrType str_type(PredType::C_S1, H5T_VARIABLE);
+		vector<const char *> rn_c_str(names.size());
+		for(size_t i = 0; i < names.size(); i++)
+			rn_c_str[i] = names[i].c_str();
+		append_h5_vec(ds, str_type, rn_c_str.data(), rn_c_str.size());
+	}
+
+	void RowNames::write_h5(const H5Location & loc, bool legacy) const
+	{
+		remove_h5(loc);
+		if(empty())
+			return;
+		write_h5_compact(loc);
+		if(legacy)
+			write_h5_legacy(loc, to_vector());
+	}
+
+	void RowNames::write_h5_compact(const H5Location & loc) const
+	{
+		remove_h5_compact(loc);
+		RowNames rn = realize();
+		const Store & store = *rn.store_;
+		switch(store.encoding)
+		{
+		case Encoding::counter:
+			{
+				int64_t buf[2] = {store.start, static_cast<int64_t>(store.count)};
+				hsize_t dims[1] = {2};
+				DataSet ds = loc.createDataSet(DATASET_ROWNAME_COUNTER, PredType::NATIVE_INT64, DataSpace(1, dims));
+				ds.write(buf, PredType::NATIVE_INT64);
+				write_prefix(ds, store.prefix);
+				break;
+			}
+		case Encoding::ids:
+			{
+				DataSet ds = write_h5_vec(loc, DATASET_ROWNAME_IDS, PredType::NATIVE_INT64, store.ids.data(), store.ids.size());
+				write_prefix(ds, store.prefix);
+				break;
+			}
+		default:
+			write_h5_vec(loc, DATASET_ROWNAME_POOL, PredType::NATIVE_CHAR, store.pool.data(), store.pool.size());
+			write_h5_vec(loc, DATASET_ROWNAME_OFFSETS, PredType::NATIVE_UINT64, store.offsets.data(), store.offsets.size());
+		}
+	}
+
+	static RowNames read_h5_compact(const H5Location & loc)
+	{
+		if(loc.exists(DATASET_ROWNAME_COUNTER))
+		{
+			DataSet ds = loc.openDataSet(DATASET_ROWNAME_COUNTER);
+			int64_t buf[2];
+			ds.read(buf, PredType::NATIVE_INT64);
+			return RowNames::counter(buf[1], buf[0], read_prefix(ds));
+		}
+		if(loc.exists(DATASET_ROWNAME_IDS))
+		{
+			DataSet ds = loc.openDataSet(DATASET_ROWNAME_IDS);
+			vector<int64_t> ids(h5_vec_size(ds));
+			if(ids.size() > 0)
+				ds.read(ids.data(), PredType::NATIVE_INT64);
+			return RowNames::from_ids(std::move(ids), read_prefix(ds));
+		}
+		if(loc.exists(DATASET_ROWNAME_POOL))
+		{
+			DataSet ds = loc.openDataSet(DATASET_ROWNAME_POOL);
+			string pool(h5_vec_size(ds), '\0');
+			if(pool.size() > 0)
+				ds.read(&pool[0], PredType::NATIVE_CHAR);
+			ds = loc.openDataSet(DATASET_ROWNAME_OFFSETS);
+			vector<uint64_t> offsets(h5_vec_size(ds));
+			if(offsets.size() > 0)
+				ds.read(offsets.data(), PredType::NATIVE_UINT64);
+			return RowNames::from_pool(std::move(pool), std::move(offsets));
+		}
+		return RowNames();
+	}
+
+	RowNames RowNames::read_h5(const H5Location & loc)
+	{
+		bool has_legacy = loc.exists(DATASET_ROWNAME);
+		if(exists_h5_compact(loc))
+		{
+			RowNames rn = read_h5_compact(loc);
+			//the earlier versions only extend the legacy strings, which then outnumber the compact ones
+			if(!has_legacy || h5_vec_size(loc.openDataSet(DATASET_ROWNAME)) == rn.size())
+				return rn;
+		}
+		if(has_legacy)
+			return RowNames(read_h5_legacy(loc));
+		return RowNames();
+	}
+
+	void RowNames::append_h5_compact(const H5Location & loc) const
+	{
+		string prefix;
+		vector<int64_t> ids;
+		bool is_id = as_ids(prefix, ids);
+		if(loc.exists(DATASET_ROWNAME_COUNTER))
+		{
+			DataSet ds = loc.openDataSet(DATASET_ROWNAME_COUNTER);
+			int64_t buf[2];
+			ds.read(buf, PredType::NATIVE_INT64);
+			if(is_id && prefix == read_prefix(ds) && is_consecutive(ids) && ids[0] == buf[0] + buf[1])
+			{
+				buf[1] += ids.size();
+				ds.write(buf, PredType::NATIVE_INT64);
+				return;
+			}
+		}
+		else if(loc.exists(DATASET_ROWNAME_IDS))
+		{
+			DataSet ds = loc.openDataSet(DATASET_ROWNAME_IDS);
+			if(is_id && prefix == read_prefix(ds))
+			{
+				append_h5_vec(ds, PredType::NATIVE_INT64, ids.data(), ids.size());
+				return;
+			}
+		}
+		else if(loc.exists(DATASET_ROWNAME_POOL))
+		{
+			DataSet ds_pool = loc.openDataSet(DATASET_ROWNAME_POOL);
+			DataSet ds_offsets = loc.openDataSet(DATASET_ROWNAME_OFFSETS);
+			//the new names start where the last one ends, which is already the last offset
+			uint64_t base = h5_vec_size(ds_pool);
+			string pool;
+			vector<uint64_t> offsets;
+			offsets.reserve(size() + 1);
+			append_pool(pool, offsets);
+			offsets.push_back(pool.size());
+			offsets.erase(offsets.begin());
+			for(auto & o : offsets)
+				o += base;
+			append_h5_vec(ds_pool, PredType::NATIVE_CHAR, pool.data(), pool.size());
+			append_h5_vec(ds_offsets, PredType::NATIVE_UINT64, offsets.data(), offsets.size());
+			return;
+		}
+		//the names of the other encoding are written again
+		read_h5_compact(loc).concat(*this).write_h5_compact(loc);
+	}
+
+	void RowNames::append_h5(const H5Location & loc) const
+	{
+		if(empty())
+			return;
+		bool has_legacy = loc.exists(DATASET_ROWNAME);
+		bool has_compact = exists_h5_compact(loc);
+		if(!has_legacy && !has_compact)
+		{
+			write_h5(loc);
+			return;
+		}
+		//each representation is extended as it is, the legacy strings are never converted
+		if(has_compact)
+			append_h5_compact(loc);
+		if(has_legacy)
+			append_h5_legacy(loc, to_vector());
+	}
+};
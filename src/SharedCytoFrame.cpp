@@ -0,0 +1,159 @@
+// Copyright 2019 Fred Hutchinson Cancer Research Center
+// See the included LICENSE file for details on the licence that is granted to the user of this software.
+#include <cytolib/SharedCytoFrame.hpp>
+#include <cytolib/H5CytoFrame.hpp>
+
+namespace cytolib
+{
+	/**
+	 * the rewritten file gets a new segment instead of serving the stale events,
+	 * and the builds of the other events precision don't share it
+	 */
+	static string shared_memory_key(const string & uri)
+	{
+		string file = uri, container, sample_uid;
+		if(parse_h5_container_uri(uri, container, sample_uid))
+			file = container;
+		return fs::canonical(file).string() + "|" + sample_uid
+				+ "|" + to_string(fs::last_write_time(file))
+				+ "|" + to_string(fs::file_size(file))
+				+ "|" + to_string(sizeof(EVENT_DATA_TYPE));
+	}
+
+	string SharedCytoFrame::shared_memory_name(const string & uri)
+	{
+		return SharedMemory::name_from_key(shared_memory_key(uri));
+	}
+
+	void SharedCytoFrame::remove_shared_memory(const string & uri)
+	{
+		SharedMemory::remove(shared_memory_name(uri));
+	}
+
+	SharedCytoFrame::SharedCytoFrame(CytoFramePtr src):src_(src)
+	{
+		CytoFrame::operator=(*src_);
+		rownames_ = src_->get_compact_rownames();
+		hsize_t nrow = src_->n_rows();
+		hsize_t ncol = src_->n_cols();
+		size_t nbytes = nrow * ncol * sizeof(EVENT_DATA_TYPE);
+		if(nbytes > 0)
+		{
+			shm_.reset(new SharedMemory(shared_memory_name(src_->get_uri()), nbytes, [&](char * buf){
+				EVENT_DATA_VEC dest(reinterpret_cast<EVENT_DATA_TYPE *>(buf), nrow, ncol, false, true);
+				dest = src_->get_data();
+			}));
+			EVENT_DATA_VEC view(reinterpret_cast<EVENT_DATA_TYPE *>(shm_->data()), nrow, ncol, false, false);
+			data_.steal_mem(view);
+		}
+		else
+			data_.set_size(nrow, ncol);
+	}
+
+	SharedCytoFrame::SharedCytoFrame(const SharedCytoFrame & frm):MemCytoFrame()
+	{
+		*this = frm;
+	}
+
+	SharedCytoFrame::SharedCytoFrame(SharedCytoFrame && frm):MemCytoFrame(std::move(frm))
+	{
+		swap(src_, frm.src_);
+		swap(shm_, frm.shm_);
+	}
+
+	SharedCytoFrame & SharedCytoFrame::operator=(const SharedCytoFrame & frm)
+	{
+		if(this == &frm)
+			return *this;
+		CytoFrame::operator=(frm);
+		rownames_ = frm.rownames_;
+		src_ = frm.src_;
+		//detach from the current segment before it is released
+		data_.reset();
+		if(frm.is_shared())
+		{
+			EVENT_DATA_VEC view(const_cast<EVENT_DATA_TYPE *>(frm.data_.memptr()), frm.data_.n_rows, frm.data_.n_cols, false, false);
+			data_.steal_mem(view);
+		}
+		else
+			data_ = frm.data_;
+		shm_ = frm.shm_;
+		return *this;
+	}
+
+	SharedCytoFrame & SharedCytoFrame::operator=(SharedCytoFrame && frm)
+	{
+		MemCytoFrame::operator=(std::move(frm));
+		swap(src_, frm.src_);
+		swap(shm_, frm.shm_);
+		return *this;
+	}
+
+	CytoFramePtr SharedCytoFrame::write_copy(const CytoFrame & fr, const string & cf_filename, bool overwrite) const
+	{
+		//the copy keeps the events layout of the source file
+		H5_WRITE_PARAM param;
+		auto h5_src = dynamic_cast<const H5CytoFrame *>(src_.get());
+		if(h5_src)
+			param = h5_src->get_h5_write_param();
+		if(is_h5_container_uri(cf_filename))
+			return write_h5_container(fr, cf_filename, param);
+		string new_filename = cf_filename;
+		if(new_filename == "")
+		{
+			new_filename = generate_unique_filename(fs::temp_directory_path().string(), "", ".h5");
+			fs::remove(new_filename);
+		}
+		else if(fs::exists(new_filename))
+		{
+			//the source is read by the other processes, so it is never overwritten
+			if(fs::equivalent(new_filename, src_->get_uri()))
+				throw(domain_error("Can't overwrite the source of the SharedCytoFrame object! " + cf_filename));
+			if(!overwrite)
+				throw(domain_error("The destination of the copy already exists! " + cf_filename));
+		}
+		fr.write_h5(new_filename, param);
+		return CytoFramePtr(new H5CytoFrame(new_filename, false));
+	}
+
+	CytoFramePtr SharedCytoFrame::copy(const string & cf_filename, bool overwrite) const
+	{
+		if(cf_filename == "")//stay in memory, as the copy of the other in-memory frames does
+			return MemCytoFrame::copy();
+		return write_copy(*this, cf_filename, overwrite);
+	}
+
+	CytoFramePtr SharedCytoFrame::copy(uvec idx, bool is_row_indexed, const string & cf_filename, bool overwrite) const
+	{
+		auto ptr = MemCytoFrame::copy(idx, is_row_indexed);
+		return cf_filename == "" ? ptr : write_copy(*ptr, cf_filename, overwrite);
+	}
+
+	CytoFramePtr SharedCytoFrame::copy(uvec row_idx, uvec col_idx, const string & cf_filename, bool overwrite) const
+	{
+		auto ptr = MemCytoFrame::copy(row_idx, col_idx);
+		return cf_filename == "" ? ptr : write_copy(*ptr, cf_filename, overwrite);
+	}
+
+	void SharedCytoFrame::convertToPb(pb::CytoFrame & fr_pb
+			, const string & cf_filename
+			, CytoFileOption h5_opt
+			, const CytoCtx & ctx) const
+	{
+		bool is_copy = h5_opt == CytoFileOption::copy && cf_filename != src_->get_uri();
+		if(is_copy && !is_h5_container_uri(cf_filename) && fs::exists(cf_filename))
+			is_copy = !fs::equivalent(cf_filename, src_->get_uri());
+		//the other options deal with the file of the source frame, which is left untouched by this frame
+		if(!is_copy)
+		{
+			src_->convertToPb(fr_pb, cf_filename, h5_opt, ctx);
+			return;
+		}
+		//write the events and meta data of this process
+		fr_pb.set_is_h5(true);
+		if(is_h5_container_uri(cf_filename))
+			write_h5_container(*this, cf_filename, ctx.get_h5_write_param());
+		else
+			write_to_disk(cf_filename, get_backend_type(), ctx);
+	}
+};
@@ -0,0 +1,328 @@
+// Copyright 2019 Fred Hutchinson Cancer Research Center
+// See the included LICENSE file for details on the licence that is granted to the user of this software.
+#include <cytolib/SharedMemory.hpp>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdio>
+#ifndef _WIN32
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace cytolib
+{
+	string SharedMemory::name_from_key(const string & key)
+	{
+		//64-bit FNV-1a, which (unlike std::hash) is the same across the processes and builds
+		uint64_t h = 14695981039346656037ULL;
+		for(unsigned char c : key)
+		{
+			h ^= c;
+			h *= 1099511628211ULL;
+		}
+		char buf[17];
+		snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(h));
+		//short enough for the 31 characters limit of macOS
+		return "/cytolib_" + string(buf);
+	}
+#ifndef _WIN32
+	enum SegmentState : uint32_t {SEGMENT_POPULATING, SEGMENT_READY, SEGMENT_FAILED};
+	struct SegmentHeader{
+		atomic<uint32_t> ref_count;
+		atomic<uint32_t> state;
+		uint64_t size;
+	};
+	static_assert(ATOMIC_INT_LOCK_FREE == 2, "the reference count in shared memory requires lock-free atomics");
+
+	/**
+	 * the header takes the first page so that the data starts at the page boundary
+	 */
+	static size_t header_bytes()
+	{
+		return sysconf(_SC_PAGESIZE);
+	}
+	static SegmentHeader * map_header(int fd, const string & name)
+	{
+		void * addr = mmap(nullptr, header_bytes(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(addr == MAP_FAILED)
+			throw(domain_error("failed to map the shared memory: " + name + "\n" + strerror(errno)));
+		return static_cast<SegmentHeader *>(addr);
+	}
+	/**
+	 * unlink the segment only when the name still refers to the given one, i.e. it hasn't been recreated since
+	 */
+	static void unlink_if_same(uint64_t dev, uint64_t ino, const string & name)
+	{
+		int cur = shm_open(name.c_str(), O_RDONLY, 0);
+		if(cur < 0)
+			return;
+		struct stat st;
+		if(fstat(cur, &st) == 0 && static_cast<uint64_t>(st.st_dev) == dev && static_cast<uint64_t>(st.st_ino) == ino)
+			shm_unlink(name.c_str());
+		close(cur);
+	}
+	static void unlink_if_same(int fd, const string & name)
+	{
+		struct stat st;
+		if(fstat(fd, &st) == 0)
+			unlink_if_same(st.st_dev, st.st_ino, name);
+	}
+	/**
+	 * flock that is retried when interrupted by a signal
+	 */
+	static void lock_segment(int fd, int operation, const string & name)
+	{
+		while(flock(fd, operation) != 0)
+			if(errno != EINTR)
+				throw(domain_error("can't lock the shared memory: " + name + "\n" + strerror(errno)));
+	}
+
+	SharedMemory::SharedMemory(const string & name, size_t size, const function<void(char *)> & populate)
+		:name_(name),header_(nullptr),addr_(nullptr),size_(size),is_creator_(false),dev_(0),ino_(0)
+	{
+		for(;;)
+		{
+			int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+			if(fd >= 0)
+			{
+				is_creator_ = true;
+				create(fd, populate);
+				return;
+			}
+			if(errno != EEXIST)
+				throw(domain_error("can't create the shared memory: " + name_ + "\n" + strerror(errno)));
+			fd = shm_open(name_.c_str(), O_RDWR, 0);
+			if(fd < 0)
+			{
+				if(errno == ENOENT)//unlinked in the meantime
+					continue;
+				throw(domain_error("can't open the shared memory: " + name_ + "\n" + strerror(errno)));
+			}
+			if(attach(fd))
+				return;
+			//the segment is being destroyed or was abandoned by its creator, start over
+		}
+	}
+
+	void SharedMemory::create(int fd, const function<void(char *)> & populate)
+	{
+		SegmentHeader * header = nullptr;
+		try
+		{
+			//the attaching processes wait on the lock until the segment is populated
+			lock_segment(fd, LOCK_EX, name_);
+			struct stat st;
+			if(fstat(fd, &st) != 0)
+				throw(domain_error("can't stat the shared memory: " + name_));
+			dev_ = st.st_dev;
+			ino_ = st.st_ino;
+			size_t nbytes = header_bytes() + size_;
+#ifdef __linux__
+			//reserve the pages upfront so that running out of shm space fails here instead of SIGBUS upon writing
+			int err = posix_fallocate(fd, 0, nbytes);
+			if(err != 0)
+				throw(domain_error("failed to allocate the shared memory: " + name_ + "\n" + strerror(err)));
+#else
+			if(ftruncate(fd, nbytes) != 0)
+				throw(domain_error("failed to allocate the shared memory: " + name_ + "\n" + strerror(errno)));
+#endif
+			header = new(map_header(fd, name_)) SegmentHeader();
+			header->ref_count = 1;
+			header->state = SEGMENT_POPULATING;
+			header->size = size_;
+			if(size_ > 0)
+			{
+				void * addr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, header_bytes());
+				if(addr == MAP_FAILED)
+					throw(domain_error("failed to map the shared memory: " + name_ + "\n" + strerror(errno)));
+				try
+				{
+					populate(static_cast<char *>(addr));
+				}
+				catch(...)
+				{
+					munmap(addr, size_);
+					throw;
+				}
+				munmap(addr, size_);
+			}
+			map_data(fd);
+			header->state = SEGMENT_READY;
+			header_ = header;
+		}
+		catch(...)
+		{
+			if(header)
+			{
+				header->state = SEGMENT_FAILED;
+				munmap(header, header_bytes());
+			}
+			unlink_if_same(fd, name_);
+			flock(fd, LOCK_UN);
+			close(fd);
+			throw;
+		}
+		flock(fd, LOCK_UN);
+		//the mappings stay valid after the descriptor is closed
+		close(fd);
+	}
+
+	bool SharedMemory::attach(int fd)
+	{
+		/*
+		 * the creator holds the exclusive lock from right after creating the segment until it is populated,
+		 * so wait on the lock however long the allocation and population take.
+		 * The segment that is still empty once locked is either about to be locked by its creator
+		 * or was abandoned by it before being sized
+		 */
+		for(int i = 0; ; i++)
+		{
+			struct stat st;
+			try
+			{
+				lock_segment(fd, LOCK_SH, name_);
+				if(fstat(fd, &st) != 0)
+					throw(domain_error("can't stat the shared memory: " + name_));
+			}
+			catch(...)
+			{
+				close(fd);
+				throw;
+			}
+			dev_ = st.st_dev;
+			ino_ = st.st_ino;
+			if(st.st_size > 0)
+				break;
+			flock(fd, LOCK_UN);
+			if(i == 1000)
+			{
+				unlink_if_same(fd, name_);
+				close(fd);
+				return false;
+			}
+			this_thread::sleep_for(chrono::milliseconds(1));
+		}
+		SegmentHeader * header;
+		try
+		{
+			header = map_header(fd, name_);
+		}
+		catch(...)
+		{
+			flock(fd, LOCK_UN);
+			close(fd);
+			throw;
+		}
+		bool attached = false;
+		if(header->state == SEGMENT_READY)
+		{
+			//the count of 0 means its last user is unlinking it
+			uint32_t n = header->ref_count;
+			while(n > 0 && !header->ref_count.compare_exchange_weak(n, n + 1));
+			attached = n > 0;
+		}
+		else//its creator died or failed while populating it
+			unlink_if_same(fd, name_);
+		flock(fd, LOCK_UN);
+		if(!attached)
+		{
+			munmap(header, header_bytes());
+			close(fd);
+			return false;
+		}
+		header_ = header;
+		try
+		{
+			if(header->size != size_)
+				throw(domain_error("the size of the shared memory doesn't match: " + name_));
+			map_data(fd);
+		}
+		catch(...)
+		{
+			close(fd);
+			detach();
+			throw;
+		}
+		close(fd);
+		return true;
+	}
+
+	void SharedMemory::map_data(int fd)
+	{
+		if(size_ == 0)
+			return;
+		//private mapping, the pages are shared until they are modified
+		void * addr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, header_bytes());
+		if(addr == MAP_FAILED)
+			throw(domain_error("failed to map the shared memory: " + name_ + "\n" + strerror(errno)));
+		addr_ = addr;
+	}
+
+	void SharedMemory::detach()
+	{
+		if(addr_)
+		{
+			munmap(addr_, size_);
+			addr_ = nullptr;
+		}
+		if(header_)
+		{
+			auto header = static_cast<SegmentHeader *>(header_);
+			//the name may refer to the new segment by now, e.g. created by the process that saw the count of 0
+			if(header->ref_count.fetch_sub(1) == 1)
+				unlink_if_same(dev_, ino_, name_);
+			munmap(header_, header_bytes());
+			header_ = nullptr;
+		}
+	}
+
+	SharedMemory::~SharedMemory()
+	{
+		detach();
+	}
+
+	unsigned SharedMemory::ref_count() const
+	{
+		return header_ ? static_cast<SegmentHeader *>(header_)->ref_count.load() : 0;
+	}
+
+	void SharedMemory::remove(const string & name)
+	{
+		shm_unlink(name.c_str());
+	}
+
+	bool SharedMemory::is_supported()
+	{
+#ifdef __APPLE__
+		return false;//flock doesn't work on the shared memory descriptors
+#else
+		return true;
+#endif
+	}
+#else
+	SharedMemory::SharedMemory(const string & name, size_t size, const function<void(char *)> & populate)
+		:name_(name),header_(nullptr),addr_(nullptr),size_(size),is_creator_(false),dev_(0),ino_(0)
+	{
+		throw(domain_error("shared memory is not supported on this platform!"));
+	}
+	SharedMemory::~SharedMemory(){}
+	unsigned SharedMemory::ref_count() const
+	{
+		return 0;
+	}
+	void SharedMemory::remove(const string & name){}
+	bool SharedMemory::is_supported()
+	{
+		return false;
+	}
+#endif
+};
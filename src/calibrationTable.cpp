@@ -74,7 +74,7 @@ namespace cytolib
 
 		return res;
 	}
-	void calibrationTable::transforming(double * input, int nSize){
+	void calibrationTable::transforming(EVENT_DATA_TYPE * input, int nSize){
 
 
 		int imeth=2;
@@ -18,7 +18,21 @@ namespace cytolib
 	bool my_throw_on_error = true;
 	unsigned short g_loglevel = 0;
 	vector<string> spillover_keys = {"SPILL", "spillover", "$SPILLOVER"};
+	static thread_local string * print_buffer = nullptr;
+	PrintBuffer::PrintBuffer():prev_(print_buffer)
+	{
+		print_buffer = &msg_;
+	}
+	PrintBuffer::~PrintBuffer()
+	{
+		print_buffer = prev_;
+	}
 	void PRINT(string a){
+	if(print_buffer)
+	{
+		*print_buffer += a;
+		return;
+	}
 	#ifdef ROUT
 	 Rprintf(a.c_str());
 	#else
@@ -27,6 +41,11 @@ namespace cytolib
 
 	}
 	void PRINT(const char * a){
+	if(print_buffer)
+	{
+		*print_buffer += a;
+		return;
+	}
 	#ifdef ROUT
 	 Rprintf(a);
 	#else
@@ -210,7 +210,7 @@ void natural_spline(vector<double>x, vector<double> y, vector<double>& b,vector<
 
 }
 
-void spline_eval(int method, double* u,int nSize,
+void spline_eval(int method, EVENT_DATA_TYPE* u,int nSize,
 		  const vector<double> & x, const vector<double> & y, const vector<double> & b, const vector<double> & c, const vector<double> & d)
 {
 /* Evaluate  v[l] := spline(u[l], ...),	    l = 1,..,nu, i.e. 0:(nu-1)
@@ -220,7 +220,7 @@ void spline_eval(int method, double* u,int nSize,
 
 	int n=x.size();
 	int nu=nSize;
-	double * v = u;//new double[nSize];
+	EVENT_DATA_TYPE * v = u;//new double[nSize];
     const int n_1 = n - 1;
     int i, j, k, l;
     double ul, dx, tmp;
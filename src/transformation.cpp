@@ -228,16 +228,17 @@ namespace cytolib
 	void biexpTrans::computCalTbl(){
 		/*
 		 * directly translated from java routine from tree star
+		 * the table is computed in double regardless of EVENT_DATA_TYPE to keep the spline precise
 		 */
 
-		EVENT_DATA_TYPE ln10 = log(10.0);
-		EVENT_DATA_TYPE decades = pos;
-		EVENT_DATA_TYPE lowScale = widthBasis;
-		EVENT_DATA_TYPE width = log10(-lowScale);
+		double ln10 = log(10.0);
+		double decades = pos;
+		double lowScale = widthBasis;
+		double width = log10(-lowScale);
 
 		if (width < 0.5 || width > 3) width = 0.5;
 		decades -= width / 2;
-		EVENT_DATA_TYPE extra = neg;
+		double extra = neg;
 		if (extra < 0) extra = 0;
 		extra += width / 2;
 
@@ -247,16 +248,16 @@ namespace cytolib
 		if (zeroChan > 0) decades = extra * channelRange / zeroChan;
 		width /= 2 * decades;        // 1.1
 
-		EVENT_DATA_TYPE maximum = maxValue;
-		EVENT_DATA_TYPE positiveRange = ln10 * decades;
-		EVENT_DATA_TYPE minimum = maximum / exp(positiveRange);
-		EVENT_DATA_TYPE negativeRange = logRoot(positiveRange, width);
+		double maximum = maxValue;
+		double positiveRange = ln10 * decades;
+		double minimum = maximum / exp(positiveRange);
+		double negativeRange = logRoot(positiveRange, width);
 
-		EVENT_DATA_TYPE maxChannlVal = channelRange + 1;
+		double maxChannlVal = channelRange + 1;
 		int nPoints = maxChannlVal;//4097;//fix the number of points so that it won't lost the precision when scale is set to 256 (i.e. channelRange = 256)
 
-		vector<EVENT_DATA_TYPE> positive(nPoints), negative(nPoints), vals(nPoints);
-		EVENT_DATA_TYPE step = (maxChannlVal-1)/(EVENT_DATA_TYPE)(nPoints -1);
+		vector<double> positive(nPoints), negative(nPoints), vals(nPoints);
+		double step = (maxChannlVal-1)/(double)(nPoints -1);
 		for (int j = 0; j < nPoints; j++)
 		{
 			vals[j] = j * step;
@@ -266,7 +267,7 @@ namespace cytolib
 
 
 
-		EVENT_DATA_TYPE s = exp((positiveRange + negativeRange) * (width + extra / decades));
+		double s = exp((positiveRange + negativeRange) * (width + extra / decades));
 		for(int j = 0; j < nPoints; j++)
 			negative[j] *= s;
 